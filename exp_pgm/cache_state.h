@@ -0,0 +1,160 @@
+//
+//  cache_state.h
+//  bench_search
+//
+//  Lookups timed in a controlled state of the caches.
+//
+//  Copying the data and the queries before a benchmark neither empties the
+//  caches nor fills them. The modes below set the state explicitly before
+//  every group of queries (--cache=cold,warm,steady, --cache-batch=N keys per
+//  group, 1 by default):
+//  - cold flushes the memory the group will read, the whole index and the
+//    last-mile window of every key, with clflushopt (clflush without it, or
+//    by reading an eviction buffer off x86) and then times the group;
+//  - warm reads the same memory first, so the group finds it in the caches
+//    (as much of it as fits);
+//  - steady runs the whole query stream once untimed, and times it again,
+//    with the timing method of timer.h: the caches hold what the stream
+//    itself keeps in them.
+//  Flushing and touching are not timed.
+//
+
+#ifndef cache_state_h
+#define cache_state_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CACHE_STATE_FLUSH 1
+#endif
+#include "timer.h"
+
+namespace cache {
+
+enum class State {
+    cold,   ///< the memory of the lookups is flushed before each group of queries
+    warm,   ///< the memory of the lookups is read before each group of queries
+    steady, ///< the query stream is replayed: timed after an untimed run
+};
+
+inline std::string to_string(State s) {
+    switch (s) {
+        case State::cold: return "cold";
+        case State::warm: return "warm";
+        default: return "steady";
+    }
+}
+
+/// Parses a comma-separated list of states, skipping the unknown ones.
+inline std::vector<State> parse_states(const std::string &s) {
+    std::vector<State> states;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "cold") states.push_back(State::cold);
+        else if (item == "warm") states.push_back(State::warm);
+        else if (item == "steady") states.push_back(State::steady);
+        else if (!item.empty()) std::cerr << "unknown cache state " << item << std::endl;
+    }
+    return states;
+}
+
+/// A contiguous area of memory read by the lookups.
+struct Region {
+    const void *begin;
+    size_t bytes;
+};
+
+constexpr size_t line_size = 64;
+
+/// The bytes read to evict the caches where cache lines cannot be flushed.
+constexpr size_t evict_bytes = size_t(256) << 20;
+
+/// Evicts the memory of a region from all the levels of the caches.
+inline void flush(Region r) {
+#if defined(CACHE_STATE_FLUSH)
+    auto p = reinterpret_cast<uintptr_t>(r.begin) & ~uintptr_t(line_size - 1);
+    auto end = reinterpret_cast<uintptr_t>(r.begin) + r.bytes;
+    for (; p < end; p += line_size) {
+#if defined(__CLFLUSHOPT__)
+        _mm_clflushopt(reinterpret_cast<void *>(p));
+#else
+        _mm_clflush(reinterpret_cast<void *>(p));
+#endif
+    }
+#else
+    (void) r;
+#endif
+}
+
+/// Waits for the flushes, then evicts the caches by reading a large buffer where cache lines cannot be flushed.
+inline void flush_done() {
+#if defined(CACHE_STATE_FLUSH)
+    _mm_mfence();
+#else
+    static std::vector<uint64_t> buffer(evict_bytes / sizeof(uint64_t), 1);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < buffer.size(); i += line_size / sizeof(uint64_t))
+        sum += buffer[i];
+    timer::do_not_optimize(sum);
+#endif
+}
+
+/// Reads every cache line of a region.
+inline void touch(Region r) {
+    auto p = static_cast<const volatile char *>(r.begin);
+    for (size_t i = 0; i < r.bytes; i += line_size)
+        (void) p[i];
+    if (r.bytes)
+        (void) p[r.bytes - 1];
+}
+
+/**
+ * Returns the total time of lookup(q) over the queries in nanoseconds, with the caches in state @p s.
+ * @param shared the regions read by every lookup, such as the index
+ * @param window window(q) returns the region that only the lookup of q reads, such as its last-mile window
+ * @param batch the number of queries timed together after the caches are set
+ */
+template<typename Queries, typename Lookup, typename Window>
+uint64_t time_queries(State s, const Queries &queries, Lookup &&lookup, const std::vector<Region> &shared,
+                      Window &&window, size_t batch = 1) {
+    if (s == State::steady) {
+        for (auto &q : queries)
+            timer::do_not_optimize(lookup(q));
+        return timer::time_queries(queries, lookup);
+    }
+
+    timer::overhead();
+    batch = std::max<size_t>(batch, 1);
+    uint64_t total = 0;
+    for (size_t i = 0; i < queries.size(); i += batch) {
+        auto end = std::min(queries.size(), i + batch);
+        if (s == State::cold) {
+            for (auto j = i; j < end; ++j)
+                flush(window(queries[j]));
+            for (auto r : shared)
+                flush(r);
+            flush_done();
+        } else {
+            for (auto r : shared)
+                touch(r);
+            for (auto j = i; j < end; ++j)
+                touch(window(queries[j]));
+        }
+        auto t = timer::start();
+        for (auto j = i; j < end; ++j)
+            timer::do_not_optimize(lookup(queries[j]));
+        total += timer::sample(t);
+    }
+    return total;
+}
+
+}
+
+#endif /* cache_state_h */
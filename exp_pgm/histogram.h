@@ -0,0 +1,154 @@
+//
+//  histogram.h
+//  bench_search
+//
+//  Log-bucketed histograms of the query latencies.
+//
+//  An average hides the queries that hit the hard regions of a dataset, which
+//  only show in the tail. The histogram below keeps every per-query latency,
+//  in the manner of HdrHistogram: the values below 64 have a bucket each, and
+//  every power of two above is split into 32 buckets, so that a value is known
+//  within 1/32 (about 3%) of itself, over the whole range of uint64_t, in 1920
+//  counters (15 KB). The counters are atomic and updated with relaxed
+//  fetch_add, so that several threads can record into the same histogram
+//  without a lock.
+//
+
+#ifndef histogram_h
+#define histogram_h
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace hist {
+
+/// The percentiles of a histogram, in the unit of its values. All zero for an empty histogram.
+struct Summary {
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+/// Writes p50, p90, p99, p99.9 and max in CSV columns, or empty columns for an empty histogram.
+inline std::ostream &operator<<(std::ostream &os, const Summary &s) {
+    if (s.count == 0)
+        return os << ",,,,";
+    return os << s.p50 << "," << s.p90 << "," << s.p99 << "," << s.p999 << "," << s.max;
+}
+
+/// Describes the percentiles, e.g. "p50 80 p90 120 p99 400 p999 900 max 5000".
+inline std::string describe(const Summary &s) {
+    return "p50 " + std::to_string(s.p50) + " p90 " + std::to_string(s.p90) + " p99 " + std::to_string(s.p99) +
+           " p999 " + std::to_string(s.p999) + " max " + std::to_string(s.max);
+}
+
+/// Returns the CSV header of a Summary: the names of the percentiles, each between @p prefix and @p suffix.
+inline std::string header(const std::string &prefix, const std::string &suffix = "") {
+    std::string h;
+    for (auto p : {"p50", "p90", "p99", "p999", "max"})
+        h += (h.empty() ? "" : ",") + prefix + p + suffix;
+    return h;
+}
+
+class Histogram {
+    static constexpr unsigned sub_bits = 5;
+    static constexpr uint64_t sub_count = uint64_t(1) << sub_bits;
+
+public:
+    /// The number of buckets covering uint64_t.
+    static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+private:
+    std::atomic<uint64_t> counts[bucket_count] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> largest{0};
+
+public:
+    Histogram() = default;
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    /// Returns the bucket of a value.
+    static size_t bucket(uint64_t value) {
+        if (value < sub_count)
+            return value;
+        unsigned shift = 63 - __builtin_clzll(value) - sub_bits;
+        return (shift + 1) * sub_count + (value >> shift) - sub_count;
+    }
+
+    /// Returns the largest value of a bucket.
+    static uint64_t highest(size_t bucket) {
+        if (bucket < sub_count)
+            return bucket;
+        unsigned shift = bucket / sub_count - 1;
+        uint64_t lowest = (bucket % sub_count + sub_count) << shift;
+        return lowest + ((uint64_t(1) << shift) - 1);
+    }
+
+    void record(uint64_t value) {
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        auto m = largest.load(std::memory_order_relaxed);
+        while (value > m && !largest.compare_exchange_weak(m, value, std::memory_order_relaxed)) {}
+    }
+
+    /// Adds the values of another histogram to this one.
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            auto c = other.counts[i].load(std::memory_order_relaxed);
+            if (c)
+                counts[i].fetch_add(c, std::memory_order_relaxed);
+        }
+        total.fetch_add(other.count(), std::memory_order_relaxed);
+        auto value = other.max();
+        auto m = largest.load(std::memory_order_relaxed);
+        while (value > m && !largest.compare_exchange_weak(m, value, std::memory_order_relaxed)) {}
+    }
+
+    void reset() {
+        for (auto &c : counts)
+            c.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+
+    /**
+     * Returns the value below or at which a fraction @p p of the recorded values lie, 0 <= p <= 1: the largest value of
+     * the bucket holding it, and at most the largest recorded value. Returns 0 for an empty histogram.
+     */
+    uint64_t percentile(double p) const {
+        auto n = count();
+        if (n == 0)
+            return 0;
+        auto rank = std::max<uint64_t>(1, uint64_t(std::ceil(p * n)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(highest(i), max());
+        }
+        return max();
+    }
+
+    Summary summary() const {
+        if (count() == 0)
+            return {};
+        return {count(), percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), max()};
+    }
+};
+
+}
+
+#endif /* histogram_h */
@@ -13,10 +13,19 @@
 #include <functional>
 #include <limits>
 #include "pgm_index.h"
+#include "pgm_index_soa.h"
+#include "pgm_index_stree.h"
+#include "cache_state.h"
+#include "histogram.h"
+#include "perf_counters.h"
 #include "search_algo.h"
 #include "utils.h"
 
 
+/// Cache states timed in addition to the default runs (see cache_state.h), and the number of queries per group.
+std::vector<cache::State> cache_states;
+size_t cache_batch = 1;
+
 auto bench_search(const size_t& n, const size_t& nq) {
     std::cout << "====== n=" << n << " nq=" << nq << " ======" << std::endl;
     auto data = benchmark::gen_random_keys<uint64_t>(n, std::numeric_limits<uint64_t>::max());
@@ -25,13 +34,9 @@ auto bench_search(const size_t& n, const size_t& nq) {
     
     uint64_t res = 0;
     
-    size_t duration_linear = 0;
-    for (auto q : queries) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = *search::lower_bound_linear(data.begin(), data.end(), q);
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_linear += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    hist::Histogram hist_linear, hist_branchless, hist_branchy;
+    size_t duration_linear = timer::time_queries(queries, [&](uint64_t q) { return res = *search::lower_bound_linear(data.begin(), data.end(), q); },
+                                                 [&](uint64_t ns) { hist_linear.record(ns); });
     
     std::cout << "Search result " << res << std::endl;
     std::cout << "Query latency (linear) " << duration_linear / nq << std::endl;
@@ -39,13 +44,8 @@ auto bench_search(const size_t& n, const size_t& nq) {
     std::vector<uint64_t> data_cpy1(data);
     std::vector<uint64_t> queries_cpy1(queries);
     
-    size_t duration_branchless = 0;
-    for (auto q : queries_cpy1) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = *search::upper_bound_branchless(data_cpy1.begin(), data_cpy1.end(), q);
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchless += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    size_t duration_branchless = timer::time_queries(queries_cpy1, [&](uint64_t q) { return res = *search::upper_bound_branchless(data_cpy1.begin(), data_cpy1.end(), q); },
+                                                     [&](uint64_t ns) { hist_branchless.record(ns); });
     
     std::cout << "Search result " << res << std::endl;
     std::cout << "Query latency (branchless) " << duration_branchless / nq << std::endl;
@@ -53,19 +53,26 @@ auto bench_search(const size_t& n, const size_t& nq) {
     std::vector<uint64_t> data_cpy2(data);
     std::vector<uint64_t> queries_cpy2(queries);
     
-    size_t duration_branchy = 0;
-    for (auto q : queries_cpy2) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = *std::lower_bound(data_cpy2.begin(), data_cpy2.end(), q);
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchy += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    size_t duration_branchy = timer::time_queries(queries_cpy2, [&](uint64_t q) { return res = *std::lower_bound(data_cpy2.begin(), data_cpy2.end(), q); },
+                                                  [&](uint64_t ns) { hist_branchy.record(ns); });
     
     std::cout << "Search result " << res << std::endl;
     std::cout << "Query latency (branchy) " << duration_branchy / nq << std::endl;
     
-    struct timer {size_t brl; size_t br; size_t linear;};
-    return timer {duration_branchless/nq, duration_branchy/nq, duration_linear/nq};
+    // the same searches with the caches in each state of cache_states
+    std::vector<size_t> cache_brl, cache_br, cache_linear;
+    std::vector<cache::Region> shared = {{data.data(), data.size() * sizeof(uint64_t)}};
+    auto no_window = [](uint64_t) { return cache::Region{nullptr, 0}; };
+    for (auto s : cache_states) {
+        cache_linear.push_back(cache::time_queries(s, queries, [&](uint64_t q) { return res = *search::lower_bound_linear(data.begin(), data.end(), q); }, shared, no_window, cache_batch) / nq);
+        cache_brl.push_back(cache::time_queries(s, queries, [&](uint64_t q) { return res = *search::upper_bound_branchless(data.begin(), data.end(), q); }, shared, no_window, cache_batch) / nq);
+        cache_br.push_back(cache::time_queries(s, queries, [&](uint64_t q) { return res = *std::lower_bound(data.begin(), data.end(), q); }, shared, no_window, cache_batch) / nq);
+        std::cout << "Query latency (" << cache::to_string(s) << " cache) linear " << cache_linear.back()
+                  << " branchless " << cache_brl.back() << " branchy " << cache_br.back() << std::endl;
+    }
+    
+    struct timer {size_t brl; size_t br; size_t linear; hist::Summary tail_brl; hist::Summary tail_br; hist::Summary tail_linear; std::vector<size_t> cache_brl; std::vector<size_t> cache_br; std::vector<size_t> cache_linear;};
+    return timer {duration_branchless/nq, duration_branchy/nq, duration_linear/nq, hist_branchless.summary(), hist_branchy.summary(), hist_linear.summary(), cache_brl, cache_br, cache_linear};
 }
 
 void bench_search_repeat(const size_t& repeat, const size_t& nq, const std::string& ouput_fname) {
@@ -76,18 +83,151 @@ void bench_search_repeat(const size_t& repeat, const size_t& nq, const std::stri
     }
     
     std::ofstream ofs(ouput_fname);
-    ofs << "n,round,brl,br,linear" << std::endl;
+    ofs << "n,round,brl,br,linear,timing," << hist::header("brl_") << "," << hist::header("br_") << "," << hist::header("linear_");
+    for (auto s : cache_states) {
+        auto name = cache::to_string(s);
+        ofs << ",brl_" << name << ",br_" << name << ",linear_" << name;
+    }
+    ofs << std::endl;
     
     for (auto n : n_list) {
         for (auto i=0; i<repeat; ++i) {
             auto res = bench_search(n, nq);
-            ofs << n << "," << i << "," << res.brl << "," << res.br << "," << res.linear << std::endl;
+            ofs << n << "," << i << "," << res.brl << "," << res.br << "," << res.linear << "," << timer::to_string(timer::method())
+                << "," << res.tail_brl << "," << res.tail_br << "," << res.tail_linear;
+            for (auto j=0; j<cache_states.size(); ++j) {
+                ofs << "," << res.cache_brl[j] << "," << res.cache_br[j] << "," << res.cache_linear[j];
+            }
+            ofs << std::endl;
         }
     }
     
     ofs.close();
 }
 
+/// Group sizes swept by the batched (interleaved) lookups.
+const std::vector<size_t> batch_sizes = {1, 2, 4, 8, 16, 32, 64};
+
+template<typename Index>
+auto bench_pgm_batch(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name) {
+    auto nq = queries.size();
+    std::vector<decltype(data.begin())> results(nq);
+    std::vector<size_t> latency;
+    
+    for (auto g : batch_sizes) {
+        auto duration = timer::time([&] {
+            index.search_data_batch(data.begin(), queries.begin(), queries.end(), results.begin(), g);
+        });
+        
+        std::cout << "Batch " << g << " query latency all (pgm index " << name << ") " << duration / nq
+                  << " throughput " << nq * 1e3 / duration << " Mops/s"
+                  << " search result " << *results.back() << std::endl;
+        latency.push_back(duration / nq);
+    }
+    return latency;
+}
+
+template<typename Index>
+auto bench_pgm_last_mile(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name) {
+    auto nq = queries.size();
+    std::vector<size_t> latency;
+    // The windows at both ends of the indexed keys, checked along with the queries
+    const auto edges = search::edge_keys(data.begin(), data.end() - 1);
+    
+    for (auto s : search::last_miles) {
+        uint64_t res = 0;
+        size_t duration = 0;
+        size_t mismatches = 0;
+        search::with_last_mile(s, [&](auto strategy) {
+            duration += timer::time_queries(queries, [&](uint64_t q) { return res = *index.template search_data<decltype(strategy)::value>(data.begin(), q); });
+            // By key, since the index may land on any copy of a duplicate key
+            for (auto keys : {&queries, &edges}) {
+                for (auto q : *keys) {
+                    auto it = index.template search_data<decltype(strategy)::value>(data.begin(), q);
+                    auto ref = std::lower_bound(data.begin(), data.end(), q);
+                    mismatches += it == data.end() || ref == data.end() ? it != ref : *it != *ref;
+                }
+            }
+        });
+        if (mismatches > 0)
+            std::cerr << search::to_string(s) << " last-mile search differs from std::lower_bound on " << mismatches << " queries" << std::endl;
+        
+        std::cout << "Query latency all (pgm index " << name << ", " << search::to_string(s) << " last mile) " << duration / nq
+                  << " search result " << res << std::endl;
+        latency.push_back(duration / nq);
+    }
+    return latency;
+}
+
+#if defined(__cpp_impl_coroutine)
+/// Interleaving degrees swept by the coroutine lookups.
+const std::vector<size_t> coro_degrees = {1, 2, 4, 8, 16, 32};
+#else
+const std::vector<size_t> coro_degrees = {};
+#endif
+
+template<typename Index>
+auto bench_pgm_coro(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name) {
+    std::vector<size_t> latency;
+#if defined(__cpp_impl_coroutine)
+    auto nq = queries.size();
+    std::vector<decltype(data.begin())> results(nq);
+    
+    for (auto d : coro_degrees) {
+        auto duration = timer::time([&] {
+            coro::interleave(d, nq,
+                             [&](size_t i) { return index.search_data_coro(data.begin(), queries[i]); },
+                             [&](size_t i, auto it) { results[i] = it; });
+        });
+        
+        std::cout << "Coro " << d << " query latency all (pgm index " << name << ") " << duration / nq
+                  << " throughput " << nq * 1e3 / duration << " Mops/s"
+                  << " search result " << *results.back() << std::endl;
+        latency.push_back(duration / nq);
+    }
+#endif
+    return latency;
+}
+
+/// Returns the latency of search_data with the caches in each state of cache_states.
+template<typename Index>
+auto bench_pgm_cache(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name) {
+    auto nq = queries.size();
+    std::vector<size_t> latency;
+    auto [segments, bytes] = index.segments_memory();
+    std::vector<cache::Region> shared = {{segments, bytes}};
+    
+    for (auto s : cache_states) {
+        uint64_t res = 0;
+        auto duration = cache::time_queries(s, queries, [&](uint64_t q) { return res = *index.search_data(data.begin(), q); }, shared, [&](uint64_t q) {
+            auto p = index.search(q);
+            return cache::Region{data.data() + p.lo, (p.hi - p.lo) * sizeof(uint64_t)};
+        }, cache_batch);
+        
+        std::cout << "Query latency all (pgm index " << name << ", " << cache::to_string(s) << " cache) " << duration / nq
+                  << " search result " << res << std::endl;
+        latency.push_back(duration / nq);
+    }
+    return latency;
+}
+
+/**
+ * Counts the events of the lookups of an index per lookup (see perf_counters.h): the inference with search(), and the
+ * last-mile search of its ranges with last_mile(lo, hi, key).
+ */
+template<typename Index, typename LastMile>
+perf::Phases bench_pgm_counters(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name, LastMile last_mile) {
+    auto phases = perf::measure_phases(queries,
+                                       [&](uint64_t q) { return index.search(q); },
+                                       [&](uint64_t q, pgm::ApproxPos p) { return last_mile(data.begin() + p.lo, data.begin() + p.hi, q); });
+    std::cout << "Counters per lookup (pgm index " << name << ") inference: " << perf::describe(phases.inference) << std::endl;
+    std::cout << "Counters per lookup (pgm index " << name << ") last mile: " << perf::describe(phases.last_mile) << std::endl;
+    return phases;
+}
+
+/// Memory budget of the radix table of the PGM, in bytes (see PGMIndex::build_radix_table). 0 disables the radix mode.
+size_t radix_table_bytes = 0;
+
 struct stats {
     size_t eps_l;
     size_t eps_i;
@@ -99,11 +239,34 @@ struct stats {
     size_t latency_branchless_i;
     size_t latency_branchy_l;
     size_t latency_branchless_l;
+    size_t latency_simd_i;
+    size_t latency_simd_l;
+    size_t bytes_soa;
+    size_t latency_soa_i;
+    size_t latency_soa_l;
+    size_t bytes_stree;
+    size_t latency_stree_i;
+    size_t latency_stree_l;
+    size_t radix_bits;
+    size_t bytes_radix;
+    size_t latency_radix_i;
+    size_t latency_radix_l;
+    std::vector<size_t> latency_batch_branchy_l;
+    std::vector<size_t> latency_batch_branchless_l;
+    std::vector<size_t> latency_coro_branchy_l;
+    std::vector<size_t> latency_coro_branchless_l;
+    std::vector<size_t> latency_last_mile_l;
+    perf::Phases counters_branchy;
+    perf::Phases counters_branchless;
+    hist::Summary tail_branchy_l;
+    hist::Summary tail_branchless_l;
+    std::vector<size_t> latency_cache_branchy_l;
+    std::vector<size_t> latency_cache_branchless_l;
 };
 
 
 template<size_t Epsilon, size_t EpsilonRecursive>
-auto bench_pgm(const std::vector<uint64_t>& data, const std::vector<uint64_t>& queries) {
+auto bench_pgm(const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries) {
     std::cout << "===========================================" << std::endl;
     auto nq = queries.size();
     
@@ -116,23 +279,48 @@ auto bench_pgm(const std::vector<uint64_t>& data, const std::vector<uint64_t>& q
     
     uint64_t res = 0;
     // branchless PGM without last-mile search
-    size_t duration_branchless = 0;
-    for (auto q : queries_cpy) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = index_branchless.search(q).pos;
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchless += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    size_t duration_branchless = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index_branchless.search(q).pos; });
     
     // branchless PGM with last-mile search
-    size_t duration_branchless_l = 0;
-    for (auto q : queries_cpy) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = *index_branchless.search_data(data.begin(), q);
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchless_l += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    hist::Histogram hist_branchless_l;
+    size_t duration_branchless_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index_branchless.search_data(data.begin(), q); },
+                                                       [&](uint64_t ns) { hist_branchless_l.record(ns); });
+    
+    // branchless PGM with SIMD level scans, without last-mile search
+    size_t duration_simd = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index_branchless.search_simd(q).pos; });
+    
+    // branchless PGM with SIMD level scans and last-mile search
+    size_t duration_simd_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index_branchless.search_data_simd(data.begin(), q); });
+    
+    // last level of the branchless PGM under a static search tree in place of the upper levels
+    pgm::STreePGMIndex<uint64_t, Epsilon, true, float> index_stree(index_branchless);
+    
+    // S-tree PGM without last-mile search
+    size_t duration_stree = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index_stree.search(q).pos; });
+    
+    // S-tree PGM with last-mile search
+    size_t duration_stree_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index_stree.search_data(data.begin(), q); });
+    
+    // branchless PGM with a radix table in place of the upper levels
+    size_t duration_radix = 0;
+    size_t duration_radix_l = 0;
+    if (radix_table_bytes) {
+        index_branchless.build_radix_table(radix_table_bytes);
+        
+        duration_radix = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index_branchless.search_radix(q).pos; });
+        
+        duration_radix_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index_branchless.search_data_radix(data.begin(), q); });
     }
     
+    // branchless PGM with structure-of-arrays layout, same segments as index_branchless
+    pgm::SoAPGMIndex<uint64_t, Epsilon, EpsilonRecursive, true, 8, float> index_soa(index_branchless);
+    
+    // SoA PGM without last-mile search
+    size_t duration_soa = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index_soa.search(q).pos; });
+    
+    // SoA PGM with last-mile search
+    size_t duration_soa_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index_soa.search_data(data.begin(), q); });
+    
     std::cout << "Search result: " << res << std::endl;
     std::cout << "PGM levels " << index_branchless.height()
               << " bytes " << index_branchless.size_in_bytes()
@@ -148,6 +336,29 @@ auto bench_pgm(const std::vector<uint64_t>& data, const std::vector<uint64_t>& q
     std::cout << std::endl;
     std::cout << "Query latency (pgm index branchless) " << duration_branchless / nq << std::endl;
     std::cout << "Query latency all (pgm index branchless) " << duration_branchless_l / nq << std::endl;
+    if (hist_branchless_l.count())
+        std::cout << "Query latency all (pgm index branchless) " << hist::describe(hist_branchless_l.summary()) << std::endl;
+    std::cout << "Query latency (pgm index simd) " << duration_simd / nq << std::endl;
+    std::cout << "Query latency all (pgm index simd) " << duration_simd_l / nq << std::endl;
+    std::cout << "PGM bytes (soa) " << index_soa.size_in_bytes() << std::endl;
+    std::cout << "PGM bytes (stree) " << index_stree.size_in_bytes() << " tree height " << index_stree.tree_height() << std::endl;
+    std::cout << "Query latency (pgm index stree) " << duration_stree / nq << std::endl;
+    std::cout << "Query latency all (pgm index stree) " << duration_stree_l / nq << std::endl;
+    if (radix_table_bytes) {
+        std::cout << "PGM radix bits " << index_branchless.radix_table_bits()
+                  << " bytes " << index_branchless.radix_table_size_in_bytes() << std::endl;
+        std::cout << "Query latency (pgm index radix) " << duration_radix / nq << std::endl;
+        std::cout << "Query latency all (pgm index radix) " << duration_radix_l / nq << std::endl;
+    }
+    std::cout << "Query latency (pgm index soa) " << duration_soa / nq << std::endl;
+    std::cout << "Query latency all (pgm index soa) " << duration_soa_l / nq << std::endl;
+    auto batch_branchless_l = bench_pgm_batch(index_branchless, data, queries_cpy, "branchless");
+    auto coro_branchless_l = bench_pgm_coro(index_branchless, data, queries_cpy, "branchless");
+    auto last_mile_l = bench_pgm_last_mile(index_branchless, data, queries_cpy, "branchless");
+    auto cache_branchless_l = bench_pgm_cache(index_branchless, data, queries_cpy, "branchless");
+    auto counters_branchless = bench_pgm_counters(index_branchless, data, queries_cpy, "branchless", [](auto lo, auto hi, uint64_t q) {
+        return search::lower_bound_branchless(lo, hi, q);
+    });
     
 
     queries_cpy.clear();
@@ -157,23 +368,13 @@ auto bench_pgm(const std::vector<uint64_t>& data, const std::vector<uint64_t>& q
     std::cout << "Construct PGM index eps_l=" << Epsilon << " eps_i=" << EpsilonRecursive << std::endl;
     pgm::PGMIndex<uint64_t, Epsilon, EpsilonRecursive, false, 0, float> index(data.begin(), data.end()-1);
     // branchy PGM without last-mile search
-    size_t duration_branchy = 0;
-    for (auto q : queries_cpy) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = index.search(q).pos;
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchy += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    size_t duration_branchy = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = index.search(q).pos; });
     
     
     // branchy PGM with last-mile search
-    size_t duration_branchy_l = 0;
-    for (auto q : queries_cpy) {
-        auto start = std::chrono::high_resolution_clock::now();
-        res = *index.search_data(data.begin(), q);
-        auto end = std::chrono::high_resolution_clock::now();
-        duration_branchy_l += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-    }
+    hist::Histogram hist_branchy_l;
+    size_t duration_branchy_l = timer::time_queries(queries_cpy, [&](uint64_t q) { return res = *index.search_data(data.begin(), q); },
+                                                    [&](uint64_t ns) { hist_branchy_l.record(ns); });
     
     std::cout << "Search result: " << res << std::endl;
     std::cout << "PGM levels " << index.height()
@@ -182,19 +383,40 @@ auto bench_pgm(const std::vector<uint64_t>& data, const std::vector<uint64_t>& q
               << " ILS " << index.internal_segments_count() << std::endl;
     std::cout << "Query latency internal (pgm index branchy) " << duration_branchy / nq << std::endl;
     std::cout << "Query latency all (pgm index branchy) " << duration_branchy_l / nq << std::endl;
+    if (hist_branchy_l.count())
+        std::cout << "Query latency all (pgm index branchy) " << hist::describe(hist_branchy_l.summary()) << std::endl;
+    auto batch_branchy_l = bench_pgm_batch(index, data, queries_cpy, "branchy");
+    auto coro_branchy_l = bench_pgm_coro(index, data, queries_cpy, "branchy");
+    auto cache_branchy_l = bench_pgm_cache(index, data, queries_cpy, "branchy");
+    auto counters_branchy = bench_pgm_counters(index, data, queries_cpy, "branchy", [](auto lo, auto hi, uint64_t q) {
+        return std::lower_bound(lo, hi, q);
+    });
     
     
-    return stats {Epsilon, EpsilonRecursive, index.height(), index.size_in_bytes(), index.segments_count(), index.internal_segments_count(), duration_branchy/nq, duration_branchless/nq, duration_branchy_l/nq, duration_branchless_l/nq};
+    return stats {Epsilon, EpsilonRecursive, index.height(), index.size_in_bytes(), index.segments_count(), index.internal_segments_count(), duration_branchy/nq, duration_branchless/nq, duration_branchy_l/nq, duration_branchless_l/nq, duration_simd/nq, duration_simd_l/nq, index_soa.size_in_bytes(), duration_soa/nq, duration_soa_l/nq, index_stree.size_in_bytes(), duration_stree/nq, duration_stree_l/nq, index_branchless.radix_table_bits(), index_branchless.radix_table_size_in_bytes(), duration_radix/nq, duration_radix_l/nq, batch_branchy_l, batch_branchless_l, coro_branchy_l, coro_branchless_l, last_mile_l, counters_branchy, counters_branchless, hist_branchy_l.summary(), hist_branchless_l.summary(), cache_branchy_l, cache_branchless_l};
 }
 
 
 int main(int argc, const char * argv[]) {
-    const std::string fname = argv[1];
+    auto options = timer::parse_args(mem::parse_args(argc, argv));
+    std::vector<std::string> args;
+    for (auto& arg : options) {
+        if (arg.rfind("--cache=", 0) == 0)
+            cache_states = cache::parse_states(arg.substr(8));
+        else if (arg.rfind("--cache-batch=", 0) == 0)
+            cache_batch = std::stoull(arg.substr(14));
+        else
+            args.push_back(arg);
+    }
+    const std::string fname = args[0];
+    if (args.size() > 2)
+        radix_table_bytes = std::stoull(args[2]);
     const size_t nq = 5000;
     const size_t repeat = 10;
     
-    std::cout << "Load data from " << fname << std::endl;
-    auto data = benchmark::load_data<uint64_t>(fname);
+    std::cout << "Load data from " << fname << " on " << mem::to_string(mem::policy().pages) << " pages" << std::endl;
+    std::cout << "Timing: " << timer::describe() << std::endl;
+    auto data = benchmark::load_data<uint64_t, mem::Allocator<uint64_t>>(fname);
     std::sort(data.begin(), data.end());
     
     std::vector<std::pair<size_t, stats>> bench_results;
@@ -295,20 +517,80 @@ int main(int argc, const char * argv[]) {
         bench_results.emplace_back(i, bench_pgm<1024, 1024>(data, queries));
     }
     
-    std::ofstream ofs(argv[2]);
-    ofs << "round,eps_l,eps_i,levels,lls,ils,latency_branchy_i,latency_branchy_l,latency_branchless_i,latency_branchless_l" << std::endl;
+    std::ofstream ofs(args[1]);
+    ofs << "round,pages,timing,eps_l,eps_i,levels,bytes,lls,ils,latency_branchy_i,latency_branchy_l,latency_branchless_i,latency_branchless_l,latency_simd_i,latency_simd_l,bytes_soa,latency_soa_i,latency_soa_l,bytes_stree,latency_stree_i,latency_stree_l";
+    if (radix_table_bytes) {
+        ofs << ",radix_bits,bytes_radix,latency_radix_i,latency_radix_l";
+    }
+    for (auto g : batch_sizes) {
+        ofs << ",latency_batch" << g << "_branchy_l,latency_batch" << g << "_branchless_l";
+    }
+    for (auto d : coro_degrees) {
+        ofs << ",latency_coro" << d << "_branchy_l,latency_coro" << d << "_branchless_l";
+    }
+    for (auto s : search::last_miles) {
+        ofs << ",latency_last_mile_" << search::to_string(s) << "_l";
+    }
+    for (auto v : {"branchy", "branchless"}) {
+        ofs << "," << perf::header("", std::string("_") + v + "_inference")
+            << "," << perf::header("", std::string("_") + v + "_last_mile");
+    }
+    ofs << "," << hist::header("latency_branchy_l_") << "," << hist::header("latency_branchless_l_");
+    for (auto s : cache_states) {
+        ofs << ",latency_" << cache::to_string(s) << "_branchy_l,latency_" << cache::to_string(s) << "_branchless_l";
+    }
+    ofs << std::endl;
     
     for (auto br : bench_results) {
         ofs << br.first << ","
+            << mem::to_string(mem::policy().pages) << ","
+            << timer::to_string(timer::method()) << ","
             << br.second.eps_l << ","
             << br.second.eps_i << ","
             << br.second.levels << ","
+            << br.second.bytes << ","
             << br.second.lls << ","
             << br.second.ils << ","
             << br.second.latency_branchy_i << ","
             << br.second.latency_branchy_l << ","
             << br.second.latency_branchless_i << ","
-            << br.second.latency_branchless_l << std::endl;
+            << br.second.latency_branchless_l << ","
+            << br.second.latency_simd_i << ","
+            << br.second.latency_simd_l << ","
+            << br.second.bytes_soa << ","
+            << br.second.latency_soa_i << ","
+            << br.second.latency_soa_l << ","
+            << br.second.bytes_stree << ","
+            << br.second.latency_stree_i << ","
+            << br.second.latency_stree_l;
+        if (radix_table_bytes) {
+            ofs << "," << br.second.radix_bits
+                << "," << br.second.bytes_radix
+                << "," << br.second.latency_radix_i
+                << "," << br.second.latency_radix_l;
+        }
+        for (auto j=0; j<batch_sizes.size(); ++j) {
+            ofs << "," << br.second.latency_batch_branchy_l[j]
+                << "," << br.second.latency_batch_branchless_l[j];
+        }
+        for (auto j=0; j<coro_degrees.size(); ++j) {
+            ofs << "," << br.second.latency_coro_branchy_l[j]
+                << "," << br.second.latency_coro_branchless_l[j];
+        }
+        for (auto t : br.second.latency_last_mile_l) {
+            ofs << "," << t;
+        }
+        ofs << "," << br.second.counters_branchy.inference
+            << "," << br.second.counters_branchy.last_mile
+            << "," << br.second.counters_branchless.inference
+            << "," << br.second.counters_branchless.last_mile;
+        ofs << "," << br.second.tail_branchy_l
+            << "," << br.second.tail_branchless_l;
+        for (auto j=0; j<cache_states.size(); ++j) {
+            ofs << "," << br.second.latency_cache_branchy_l[j]
+                << "," << br.second.latency_cache_branchless_l[j];
+        }
+        ofs << std::endl;
     }
     
     ofs.close();
@@ -15,6 +15,8 @@
 
 #pragma once
 
+#include "coro.h"
+#include "page_alloc.h"
 #include "piecewise_linear_model.h"
 #include "search_algo.h"
 #include <algorithm>
@@ -24,6 +26,7 @@
 #include <limits>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -73,15 +76,20 @@ protected:
     template<typename, size_t, typename>
     friend class EliasFanoPGMIndex;
 
+    template<typename, bool, size_t, typename>
+    friend class RuntimePGMIndex;
+
     static_assert(Epsilon > 0);
     struct Segment;
 
     size_t n;                           ///< The number of elements this index was built on.
     K first_key;                        ///< The smallest element.
-    std::vector<Segment> segments;      ///< The segments composing the index.
+    mem::vector<Segment> segments;      ///< The segments composing the index, placed by mem::policy().
     std::vector<size_t> levels_offsets; ///< The starting position of each level in segments[], in reverse order.
     std::vector<size_t> levels_segment_count;
     int start_level;
+    std::vector<uint32_t> radix_table;  ///< The level-0 segments grouped by key prefix, see @ref build_radix_table.
+    size_t radix_shift = 0;             ///< The shift that extracts the prefix of a key from its distance to first_key.
     
     /// Sentinel value to avoid bounds checking.
     static constexpr K sentinel = std::numeric_limits<K>::has_infinity ? std::numeric_limits<K>::infinity()
@@ -90,7 +98,7 @@ protected:
     template<typename RandomIt>
     static void build(RandomIt first, RandomIt last,
                       size_t epsilon, size_t epsilon_recursive,
-                      std::vector<Segment> &segments,
+                      mem::vector<Segment> &segments,
                       std::vector<size_t> &levels_offsets,
                       std::vector<size_t> &levels_segment_count,
                       int &start_level) {
@@ -169,32 +177,153 @@ protected:
 //        }
         
         for (; l >= 0; --l) {
-            auto level_begin = segments.begin() + levels_offsets[l];
-            auto pos = std::min<size_t>((*it)(key), std::next(it)->intercept);
-            auto lo = level_begin + PGM_SUB_EPS(pos, EpsilonRecursive + 1);
-
-//            static constexpr size_t linear_search_threshold = 8 * 64 / sizeof(Segment);
-            if constexpr (EpsilonRecursive <= linear_search_threshold) {
-                for (; std::next(lo)->key <= key; ++lo)
-                    continue;
-                it = lo;
+            auto [lo, hi] = level_window(l, it, key);
+            it = level_search(lo, hi, key);
+        }
+        return it;
+    }
+
+    /**
+     * Same as @ref segment_for_key, but the upper levels are skipped: the radix table maps the prefix of the key to the
+     * range of level-0 segments whose keys share that prefix, and only this range is searched. Falls back to
+     * @ref segment_for_key if the table has not been built.
+     */
+    auto segment_for_key_radix(const K &key) const {
+        if (radix_table.empty())
+            return segment_for_key(key);
+
+        using U = std::make_unsigned_t<K>;
+        auto b = std::min<size_t>((U(key) - U(first_key)) >> radix_shift, radix_table.size() - 2);
+        auto lo = segments.begin() + radix_table[b];
+        auto hi = segments.begin() + radix_table[b + 1];
+
+        // The segment at hi has a larger prefix than the key, or it is the sentinel, so it is > key and [lo, hi] can
+        // be searched without bounds checking. The result is at least lo - 1, which is the last segment of a smaller
+        // prefix, or the first segment if b is 0.
+        if constexpr (BranchLessSearch) {
+            return std::prev(search::upper_bound_branchless(lo, std::next(hi), key));
+        } else {
+            return std::prev(std::upper_bound(lo, hi, key));
+        }
+    }
+
+    /**
+     * Returns the range [lo, hi) of level @p l where the segment responsible for @p key lies.
+     * @param l the level to search
+     * @param it the segment responsible for @p key in level l + 1
+     * @param key the value of the element to search for
+     * @return the pair of iterators lo and hi
+     */
+    template<typename SegmentIt>
+    auto level_window(int l, SegmentIt it, const K &key) const {
+        auto level_begin = segments.begin() + levels_offsets[l];
+        auto pos = std::min<size_t>((*it)(key), std::next(it)->intercept);
+        auto lo = level_begin + PGM_SUB_EPS(pos, EpsilonRecursive + 1);
+        auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
+        auto hi = level_begin + PGM_ADD_EPS(pos, EpsilonRecursive, level_size);
+        return std::make_pair(lo, hi);
+    }
+
+    /**
+     * Same as @ref segment_for_key, but each level is searched with the SIMD kernels of search_algo.h. The packed
+     * segments are compared in place, one key lane every 16 bytes, so neither a gather nor a separate copy of the
+     * keys is needed. Falls back to @ref segment_for_key for other key types and segment layouts.
+     */
+    auto segment_for_key_simd(const K &key) const {
+        if constexpr (!std::is_same_v<K, uint64_t> || sizeof(Segment) != 2 * sizeof(uint64_t)) {
+            return segment_for_key(key);
+        } else if constexpr (EpsilonRecursive == 0) {
+            auto first = segments.begin();
+            return std::prev(upper_bound_simd<std::numeric_limits<size_t>::max()>(first, first + segments_count(), key));
+        } else {
+            auto it = segments.begin() + *(levels_offsets.end() - 2);
+            for (auto l = int(height()) - 2; l >= 0; --l) {
+                auto [lo, hi] = level_window(l, it, key);
+                it = std::prev(upper_bound_simd<2 * EpsilonRecursive + 3>(lo, hi, key));
+            }
+            return it;
+        }
+    }
+
+    /**
+     * Returns the first segment in [lo, hi) having key > the sought key, where hi - lo <= max_size. Windows of up to
+     * 64 segments are scanned entirely, longer ones are first narrowed by branchless binary steps.
+     */
+    template<size_t max_size, typename SegmentIt>
+    static SegmentIt upper_bound_simd(SegmentIt lo, SegmentIt hi, const K &key) {
+        constexpr size_t scan_size = max_size <= 64 ? max_size : 32;
+        auto p = reinterpret_cast<const uint64_t *>(&*lo);
+        return lo + search::bound_simd<true, scan_size, 2>(p, std::distance(lo, hi), key);
+    }
+
+    /**
+     * Returns the rightmost segment in [lo, hi) having key <= the sought key.
+     */
+    template<typename SegmentIt>
+    SegmentIt level_search(SegmentIt lo, SegmentIt hi, const K &key) const {
+//        static constexpr size_t linear_search_threshold = 8 * 64 / sizeof(Segment);
+        if constexpr (EpsilonRecursive <= linear_search_threshold) {
+            for (; std::next(lo)->key <= key; ++lo)
+                continue;
+            return lo;
+        } else {
+            if constexpr (BranchLessSearch) {
+                return std::prev(search::upper_bound_branchless(lo, hi, key));
             } else {
-                auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
-                auto hi = level_begin + PGM_ADD_EPS(pos, EpsilonRecursive, level_size);
-                if constexpr (BranchLessSearch) {
-                    it = std::prev(search::upper_bound_branchless(lo, hi, key));
-                } else {
-                    it = std::prev(std::upper_bound(lo, hi, key));
-                }
+                return std::prev(std::upper_bound(lo, hi, key));
             }
         }
-        return it;
+    }
+
+    template<typename RandomIt>
+    static RandomIt last_mile_search(RandomIt lo, RandomIt hi, const K &key) {
+        if constexpr (BranchLessSearch) {
+            return search::lower_bound_branchless(lo, hi, key);
+        } else {
+            return std::lower_bound(lo, hi, key);
+        }
+    }
+
+    /**
+     * Finds the last-level segments responsible for a group of at most @ref max_batch_group keys.
+     *
+     * The keys of the group walk down the levels in lockstep: the search windows of all the keys in the next level are
+     * prefetched before any of them is searched, so that the cache misses of different keys overlap instead of forming
+     * one chain of dependent misses per key.
+     * @param keys the keys of the group
+     * @param g the number of keys in the group
+     * @param its the output segment iterators, one per key
+     */
+    template<typename KeyIt, typename SegmentIt>
+    void segments_for_keys(KeyIt keys, size_t g, SegmentIt *its) const {
+        if constexpr (EpsilonRecursive == 0) {
+            for (size_t i = 0; i < g; ++i)
+                its[i] = segment_for_key(std::max<K>(first_key, keys[i]));
+            return;
+        }
+
+        SegmentIt lo[max_batch_group], hi[max_batch_group];
+        auto top = segments.begin() + *(levels_offsets.end() - 2);
+        for (size_t i = 0; i < g; ++i)
+            its[i] = top;
+
+        for (auto l = int(height()) - 2; l >= 0; --l) {
+            for (size_t i = 0; i < g; ++i) {
+                std::tie(lo[i], hi[i]) = level_window(l, its[i], std::max<K>(first_key, keys[i]));
+                search::prefetch_range(&*lo[i], &*hi[i] + 1);
+            }
+            for (size_t i = 0; i < g; ++i)
+                its[i] = level_search(lo[i], hi[i], std::max<K>(first_key, keys[i]));
+        }
     }
 
 public:
 
     static constexpr size_t epsilon_value = Epsilon;
 
+    /// The maximum number of lookups interleaved by @ref search_batch and @ref search_data_batch.
+    static constexpr size_t max_batch_group = 64;
+
     /**
      * Constructs an empty index.
      */
@@ -235,21 +364,217 @@ public:
     }
     
     template<typename RandomIt>
-    RandomIt search_data(RandomIt start, const K &key) {
+    RandomIt search_data(RandomIt start, const K &key) const {
         auto k = std::max(first_key, key);
         auto it = segment_for_key(k);
         auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
         auto lo = PGM_SUB_EPS(pos, Epsilon);
         auto hi = PGM_ADD_EPS(pos, Epsilon, n);
-        if constexpr (BranchLessSearch) {
-            return search::lower_bound_branchless(start+lo, start+hi, key);
-        } else {
-            return std::lower_bound(start+lo, start+hi, key);
+        return last_mile_search(start + lo, start + hi, key);
+    }
+
+    /**
+     * Same as @ref search_data, but the last-mile window is searched with the strategy S (see search::LastMile)
+     * instead of the one chosen by BranchLessSearch.
+     */
+    template<search::LastMile S, typename RandomIt>
+    RandomIt search_data(RandomIt start, const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return search::last_mile<S>(start + lo, start + hi, start + pos, key);
+    }
+
+    /**
+     * Same as @ref search, but the levels are scanned with SIMD instructions (see @ref segment_for_key_simd).
+     */
+    ApproxPos search_simd(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key_simd(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Same as @ref search_data, but both the levels and the last-mile window are searched with SIMD instructions. The
+     * last-mile kernel is chosen at compile time from the window size 2 * Epsilon + 2: small windows are scanned
+     * entirely, larger ones are first narrowed by a few branchless binary steps.
+     */
+    template<typename RandomIt>
+    RandomIt search_data_simd(RandomIt start, const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key_simd(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return search::lower_bound_simd_bounded<2 * Epsilon + 2>(start + lo, start + hi, key);
+    }
+
+    /**
+     * Builds a radix table that maps the top bits of the distance of a key from the smallest key to the range of
+     * level-0 segments having the same top bits, in the style of RadixSpline. The number of bits r is the largest one
+     * whose table of 2^r + 1 entries fits in @p max_bytes, and at most the number of bits of the key range. A budget
+     * below 3 entries (r = 0, which would shift a 64-bit range by 64) builds no table.
+     * @param max_bytes the memory budget of the table, in bytes
+     */
+    void build_radix_table(size_t max_bytes) {
+        radix_table.clear();
+        radix_shift = 0;
+        if constexpr (std::is_integral_v<K>) {
+            if (segments.empty() || max_bytes < 3 * sizeof(uint32_t))
+                return;
+
+            using U = std::make_unsigned_t<K>;
+            auto count = segments_count();
+            auto span = uint64_t(U(segments[count - 1].key) - U(first_key));
+            size_t span_bits = span ? 64 - __builtin_clzll(span) : 0;
+            size_t bits = 0;
+            while (bits < span_bits && ((size_t(1) << (bits + 1)) + 1) * sizeof(uint32_t) <= max_bytes)
+                ++bits;
+            radix_shift = span_bits - bits;
+
+            // radix_table[b] is the first segment whose key has prefix >= b
+            auto buckets = size_t(1) << bits;
+            radix_table.resize(buckets + 1);
+            size_t b = 0;
+            for (size_t i = 0; i < count; ++i) {
+                auto prefix = (U(segments[i].key) - U(first_key)) >> radix_shift;
+                for (; b <= prefix; ++b)
+                    radix_table[b] = uint32_t(i);
+            }
+            for (; b <= buckets; ++b)
+                radix_table[b] = uint32_t(count);
+        }
+    }
+
+    /**
+     * Same as @ref search, but the upper levels are replaced by a single access to the radix table (see
+     * @ref build_radix_table). Without the table, it is the same as @ref search.
+     */
+    ApproxPos search_radix(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key_radix(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Same as @ref search_data, but the segment is found through the radix table (see @ref search_radix).
+     */
+    template<typename RandomIt>
+    RandomIt search_data_radix(RandomIt start, const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key_radix(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return last_mile_search(start + lo, start + hi, key);
+    }
+
+    /**
+     * Returns the approximate positions and the ranges of a sequence of keys.
+     *
+     * The keys are processed in groups of @p group keys, and the lookups of a group proceed in lockstep with software
+     * prefetching (see @ref segments_for_keys). This pays off when the keys are independent of each other.
+     * @param first, last the range of keys to search for
+     * @param out the output iterator receiving one @ref ApproxPos per key
+     * @param group the number of lookups that are interleaved, at most @ref max_batch_group
+     */
+    template<typename KeyIt, typename OutIt>
+    void search_batch(KeyIt first, KeyIt last, OutIt out, size_t group = 16) const {
+        decltype(segments.cbegin()) its[max_batch_group];
+        group = std::clamp<size_t>(group, 1, max_batch_group);
+
+        for (auto n_keys = size_t(std::distance(first, last)); n_keys > 0; ) {
+            auto g = std::min(group, n_keys);
+            segments_for_keys(first, g, its);
+            for (size_t i = 0; i < g; ++i, ++out) {
+                auto k = std::max<K>(first_key, first[i]);
+                auto pos = std::min<size_t>((*its[i])(k), std::next(its[i])->intercept);
+                *out = ApproxPos{pos, PGM_SUB_EPS(pos, Epsilon), PGM_ADD_EPS(pos, Epsilon, n)};
+            }
+            first += g;
+            n_keys -= g;
+        }
+    }
+
+    std::vector<ApproxPos> search_batch(const std::vector<K> &keys, size_t group = 16) const {
+        std::vector<ApproxPos> out(keys.size());
+        search_batch(keys.begin(), keys.end(), out.begin(), group);
+        return out;
+    }
+
+    /**
+     * Batched version of @ref search_data: for every key in [first, last) writes to @p out an iterator to the first
+     * element in the data that is not less than the key.
+     *
+     * On top of the lockstep traversal of the levels done by @ref search_batch, the last-mile windows of all the keys
+     * of a group are prefetched before any of them is searched.
+     * @param start the beginning of the indexed data
+     * @param first, last the range of keys to search for
+     * @param out the output iterator receiving one data iterator per key
+     * @param group the number of lookups that are interleaved, at most @ref max_batch_group
+     */
+    template<typename RandomIt, typename KeyIt, typename OutIt>
+    void search_data_batch(RandomIt start, KeyIt first, KeyIt last, OutIt out, size_t group = 16) const {
+        decltype(segments.cbegin()) its[max_batch_group];
+        size_t lo[max_batch_group], hi[max_batch_group];
+        group = std::clamp<size_t>(group, 1, max_batch_group);
+
+        for (auto n_keys = size_t(std::distance(first, last)); n_keys > 0; ) {
+            auto g = std::min(group, n_keys);
+            segments_for_keys(first, g, its);
+            for (size_t i = 0; i < g; ++i) {
+                auto k = std::max<K>(first_key, first[i]);
+                auto pos = std::min<size_t>((*its[i])(k), std::next(its[i])->intercept);
+                lo[i] = PGM_SUB_EPS(pos, Epsilon);
+                hi[i] = PGM_ADD_EPS(pos, Epsilon, n);
+                search::prefetch_range(&start[lo[i]], &start[lo[i]] + (hi[i] - lo[i]));
+            }
+            for (size_t i = 0; i < g; ++i, ++out)
+                *out = last_mile_search(start + lo[i], start + hi[i], first[i]);
+            first += g;
+            n_keys -= g;
         }
     }
     
 
-    std::vector<Segment> get_segments() const {
+#if defined(__cpp_impl_coroutine)
+    /**
+     * Coroutine version of @ref search_data, to be run by @ref coro::interleave.
+     *
+     * The lookup suspends wherever it would otherwise stall on a cache miss: after computing the position in each
+     * level, and before the last-mile search in the data. Each suspension first prefetches the memory about to be
+     * searched.
+     */
+    template<typename RandomIt>
+    coro::Task<RandomIt> search_data_coro(RandomIt start, K key) const {
+        auto k = std::max(first_key, key);
+        auto it = segments.begin() + *(levels_offsets.end() - 2);
+        if constexpr (EpsilonRecursive == 0) {
+            it = segment_for_key(k);
+        } else {
+            for (auto l = int(height()) - 2; l >= 0; --l) {
+                auto [lo, hi] = level_window(l, it, k);
+                co_await coro::prefetch(&*lo);
+                it = level_search(lo, hi, k);
+            }
+        }
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        co_await coro::prefetch(&start[lo] + (pos - lo));
+        co_return last_mile_search(start + lo, start + hi, key);
+    }
+#endif
+
+    mem::vector<Segment> get_segments() const {
         return segments;
     }
 
@@ -261,6 +586,12 @@ public:
         return levels_segment_count;
     }
 
+    /**
+     * Returns the number of elements the index was built on.
+     * @return the number of elements the index was built on
+     */
+    size_t size() const { return n; }
+
     size_t internal_segments_count() const { return levels_offsets.back() - levels_offsets[1]; }
 
     /**
@@ -280,6 +611,26 @@ public:
      * @return the size of the index in bytes
      */
     size_t size_in_bytes() const { return segments.size() * sizeof(Segment) + levels_offsets.size() * sizeof(size_t); }
+
+    /**
+     * Returns the memory holding the segments of all the levels, e.g. to flush it from the caches.
+     * @return the address and the size in bytes of the segments
+     */
+    std::pair<const void *, size_t> segments_memory() const {
+        return {segments.data(), segments.size() * sizeof(Segment)};
+    }
+
+    /**
+     * Returns the number of bits of the key prefixes indexed by the radix table, or 0 if there is no table.
+     * @return the number of bits indexed by the radix table
+     */
+    size_t radix_table_bits() const { return radix_table.empty() ? 0 : __builtin_ctzll(radix_table.size() - 1); }
+
+    /**
+     * Returns the size of the radix table in bytes, which is not included in @ref size_in_bytes.
+     * @return the size of the radix table in bytes
+     */
+    size_t radix_table_size_in_bytes() const { return radix_table.size() * sizeof(uint32_t); }
 };
 
 #pragma pack(push, 1)
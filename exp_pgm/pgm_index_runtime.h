@@ -0,0 +1,227 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "pgm_index.h"
+#include "page_alloc.h"
+#include "search_algo.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace pgm {
+
+/**
+ * A @ref PGMIndex whose epsilon values are given to the constructor instead of being template arguments, so that any
+ * point of the (Epsilon, EpsilonRecursive) space can be built by the same binary.
+ *
+ * The segments are the same as those of a @ref PGMIndex with the same values. @ref search_data is dispatched once, at
+ * construction, to a lookup compiled for the value of epsilon when it is a power of two between 4 and 1024 (the grid
+ * of the benchmark), and for the kind of search of the upper levels, so that these configurations run almost the same
+ * code as the compile-time index.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Floating the floating-point type to use for slopes
+ */
+template<typename K, bool BranchLessSearch = false, size_t linear_search_threshold = 32, typename Floating = float>
+class RuntimePGMIndex {
+protected:
+    using base_type = PGMIndex<K, 1, 0, BranchLessSearch, linear_search_threshold, Floating>;
+    using Segment = typename base_type::Segment;
+    using lookup_fn = const K *(*)(const RuntimePGMIndex &, const K *, const K &);
+
+    size_t n;                           ///< The number of elements this index was built on.
+    size_t epsilon;                     ///< The size of the returned search range.
+    size_t epsilon_recursive;           ///< The size of the search range in the internal structure.
+    K first_key;                        ///< The smallest element.
+    mem::vector<Segment> segments;      ///< The segments composing the index.
+    std::vector<size_t> levels_offsets; ///< The starting position of each level in segments[], in reverse order.
+    std::vector<size_t> levels_segment_count;
+    int start_level;
+    lookup_fn lookup_epsilon;           ///< The lookup specialised for the value of epsilon.
+
+    /**
+     * The lookup of @ref search_data, for a given epsilon value E (or for any value, if E is 0) and a given kind of
+     * search in the upper levels.
+     */
+    template<size_t E, bool LinearLevels>
+    static const K *lookup(const RuntimePGMIndex &index, const K *data, const K &key) {
+        auto epsilon = E ? E : index.epsilon;
+        auto k = std::max(index.first_key, key);
+        auto it = index.template segment_for_key<LinearLevels>(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, epsilon);
+        auto hi = PGM_ADD_EPS(pos, epsilon, index.n);
+        if constexpr (BranchLessSearch) {
+            return search::lower_bound_branchless(data + lo, data + hi, key);
+        } else {
+            return std::lower_bound(data + lo, data + hi, key);
+        }
+    }
+
+    template<bool LinearLevels, size_t E, size_t... Es>
+    static lookup_fn select_lookup(size_t epsilon) {
+        if (epsilon == E)
+            return &lookup<E, LinearLevels>;
+        if constexpr (sizeof...(Es) > 0)
+            return select_lookup<LinearLevels, Es...>(epsilon);
+        else
+            return &lookup<0, LinearLevels>;
+    }
+
+    static lookup_fn select_lookup(size_t epsilon, size_t epsilon_recursive) {
+        if (epsilon_recursive <= linear_search_threshold)
+            return select_lookup<true, 4, 8, 16, 32, 64, 128, 256, 512, 1024>(epsilon);
+        return select_lookup<false, 4, 8, 16, 32, 64, 128, 256, 512, 1024>(epsilon);
+    }
+
+    /**
+     * Returns the segment responsible for a given key, that is, the rightmost segment having key <= the sought key.
+     * @tparam LinearLevels whether the upper levels are searched linearly, that is, epsilon_recursive is at most
+     * linear_search_threshold
+     */
+    template<bool LinearLevels>
+    auto segment_for_key(const K &key) const {
+        if (epsilon_recursive == 0) {
+            if constexpr (BranchLessSearch) {
+                return std::prev(search::upper_bound_branchless(segments.begin(), segments.begin() + segments_count(), key));
+            } else {
+                return std::prev(std::upper_bound(segments.begin(), segments.begin() + segments_count(), key));
+            }
+        }
+
+        auto it = segments.begin() + *(levels_offsets.end() - 2);
+        for (auto l = int(height()) - 2; l >= 0; --l) {
+            auto level_begin = segments.begin() + levels_offsets[l];
+            auto pos = std::min<size_t>((*it)(key), std::next(it)->intercept);
+            auto lo = level_begin + PGM_SUB_EPS(pos, epsilon_recursive + 1);
+
+            if constexpr (LinearLevels) {
+                for (; std::next(lo)->key <= key; ++lo)
+                    continue;
+                it = lo;
+            } else {
+                auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
+                auto hi = level_begin + PGM_ADD_EPS(pos, epsilon_recursive, level_size);
+                if constexpr (BranchLessSearch) {
+                    it = std::prev(search::upper_bound_branchless(lo, hi, key));
+                } else {
+                    it = std::prev(std::upper_bound(lo, hi, key));
+                }
+            }
+        }
+        return it;
+    }
+
+public:
+
+    /**
+     * Constructs an empty index.
+     */
+    RuntimePGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     * @param epsilon controls the size of the returned search range
+     * @param epsilon_recursive controls the size of the search range in the internal structure
+     */
+    template<typename Alloc>
+    RuntimePGMIndex(const std::vector<K, Alloc> &data, size_t epsilon, size_t epsilon_recursive)
+        : RuntimePGMIndex(data.begin(), data.end(), epsilon, epsilon_recursive) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param epsilon controls the size of the returned search range
+     * @param epsilon_recursive controls the size of the search range in the internal structure
+     */
+    template<typename RandomIt>
+    RuntimePGMIndex(RandomIt first, RandomIt last, size_t epsilon, size_t epsilon_recursive)
+        : n(std::distance(first, last)),
+          epsilon(epsilon),
+          epsilon_recursive(epsilon_recursive),
+          first_key(n ? *first : K(0)),
+          segments(),
+          levels_offsets(),
+          levels_segment_count(),
+          start_level(0),
+          lookup_epsilon(select_lookup(epsilon, epsilon_recursive)) {
+        if (epsilon == 0)
+            throw std::invalid_argument("epsilon must be > 0");
+        base_type::build(first, last, epsilon, epsilon_recursive, segments, levels_offsets, levels_segment_count, start_level);
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto it = epsilon_recursive <= linear_search_threshold ? segment_for_key<true>(k) : segment_for_key<false>(k);
+        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
+        auto lo = PGM_SUB_EPS(pos, epsilon);
+        auto hi = PGM_ADD_EPS(pos, epsilon, n);
+        return {pos, lo, hi};
+    }
+
+    template<typename RandomIt>
+    RandomIt search_data(RandomIt start, const K &key) const {
+        return start + (lookup_epsilon(*this, &start[0], key) - &start[0]);
+    }
+
+    size_t epsilon_value() const { return epsilon; }
+
+    size_t epsilon_recursive_value() const { return epsilon_recursive; }
+
+    std::vector<size_t> get_levels_offsets() const {
+        return levels_offsets;
+    }
+
+    std::vector<size_t> get_levels_segment_count() const {
+        return levels_segment_count;
+    }
+
+    /**
+     * Returns the number of elements the index was built on.
+     * @return the number of elements the index was built on
+     */
+    size_t size() const { return n; }
+
+    size_t internal_segments_count() const { return levels_offsets.back() - levels_offsets[1]; }
+
+    /**
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return segments.empty() ? 0 : levels_offsets[1] - 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return levels_offsets.size() - 1; }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const { return segments.size() * sizeof(Segment) + levels_offsets.size() * sizeof(size_t); }
+};
+
+}
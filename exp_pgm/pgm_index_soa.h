@@ -0,0 +1,235 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "pgm_index.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace pgm {
+
+namespace internal {
+
+/**
+ * An allocator returning memory aligned to @p Alignment bytes (by default, a cache line).
+ */
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template<typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+}
+
+/**
+ * A PGM-index with a structure-of-arrays layout of the segments.
+ *
+ * @ref PGMIndex stores each segment as a packed (key, slope, intercept) record, so the scan of a level brings into
+ * the cache the slopes and intercepts of all the segments it compares, although only their keys are needed. This
+ * variant stores each level as two cache-line-aligned arrays: one with the keys of the segments, which is the only
+ * one read while searching the level, and one with their (slope, intercept) pairs, which is read once the segment has
+ * been chosen.
+ *
+ * The segments are the same as those of the @ref PGMIndex with the same template arguments, and the index can be
+ * converted from it.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ */
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, bool BranchLessSearch = false, size_t linear_search_threshold = 32, typename Floating = float>
+class SoAPGMIndex {
+protected:
+    using base_type = PGMIndex<K, Epsilon, EpsilonRecursive, BranchLessSearch, linear_search_threshold, Floating>;
+
+    struct Model {
+        Floating slope;     ///< The slope of the segment.
+        uint32_t intercept; ///< The intercept of the segment.
+    };
+
+    struct Level {
+        internal::aligned_vector<K> keys;       ///< The first key that each segment of the level indexes.
+        internal::aligned_vector<Model> models; ///< The model of each segment of the level.
+    };
+
+    size_t n;                 ///< The number of elements this index was built on.
+    K first_key;              ///< The smallest element.
+    std::vector<Level> levels; ///< The levels of the index, from the last one (level 0) to the root.
+
+    /// Returns the approximate position of @p k according to the i-th segment of @p level.
+    static size_t predict(const Level &level, size_t i, const K &k) {
+        const auto &m = level.models[i];
+        size_t pos;
+        if constexpr (std::is_same_v<K, int64_t> || std::is_same_v<K, int32_t>)
+            pos = size_t(m.slope * double(std::make_unsigned_t<K>(k) - level.keys[i]));
+        else
+            pos = size_t(m.slope * double(k - level.keys[i]));
+        return std::min<size_t>(pos + m.intercept, level.models[i + 1].intercept);
+    }
+
+    /**
+     * Returns the index of the segment of level 0 responsible for a given key, that is, the rightmost segment having
+     * key <= the sought key.
+     */
+    size_t segment_for_key(const K &key) const {
+        if constexpr (EpsilonRecursive == 0) {
+            auto &keys = levels[0].keys;
+            auto last = keys.begin() + (keys.size() - 1);
+            if constexpr (BranchLessSearch)
+                return std::distance(keys.begin(), search::upper_bound_branchless(keys.begin(), last, key)) - 1;
+            else
+                return std::distance(keys.begin(), std::upper_bound(keys.begin(), last, key)) - 1;
+        }
+
+        size_t i = 0;
+        for (auto l = int(levels.size()) - 2; l >= 0; --l) {
+            auto &keys = levels[l].keys;
+            auto pos = predict(levels[l + 1], i, key);
+            auto lo = PGM_SUB_EPS(pos, EpsilonRecursive + 1);
+
+            if constexpr (EpsilonRecursive <= linear_search_threshold) {
+                for (; keys[lo + 1] <= key; ++lo)
+                    continue;
+                i = lo;
+            } else {
+                auto hi = PGM_ADD_EPS(pos, EpsilonRecursive, keys.size() - 1);
+                if constexpr (BranchLessSearch)
+                    i = std::distance(keys.begin(), search::upper_bound_branchless(keys.begin() + lo, keys.begin() + hi, key)) - 1;
+                else
+                    i = std::distance(keys.begin(), std::upper_bound(keys.begin() + lo, keys.begin() + hi, key)) - 1;
+            }
+        }
+        return i;
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty index.
+     */
+    SoAPGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     */
+    explicit SoAPGMIndex(const std::vector<K> &data) : SoAPGMIndex(data.begin(), data.end()) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     */
+    template<typename RandomIt>
+    SoAPGMIndex(RandomIt first, RandomIt last) : SoAPGMIndex(base_type(first, last)) {}
+
+    /**
+     * Constructs the index with the same segments of a @ref PGMIndex.
+     * @param index the index to convert
+     */
+    explicit SoAPGMIndex(const base_type &index) : n(index.size()), first_key(), levels() {
+        auto segments = index.get_segments();
+        auto offsets = index.get_levels_offsets();
+        if (segments.empty())
+            return;
+
+        first_key = segments.front().key;
+        levels.resize(offsets.size() - 1);
+        for (size_t l = 0; l < levels.size(); ++l) {
+            auto &level = levels[l];
+            level.keys.reserve(offsets[l + 1] - offsets[l]);
+            level.models.reserve(offsets[l + 1] - offsets[l]);
+            for (auto i = offsets[l]; i < offsets[l + 1]; ++i) {
+                level.keys.push_back(segments[i].key);
+                level.models.push_back({segments[i].slope, segments[i].intercept});
+            }
+        }
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto pos = predict(levels[0], segment_for_key(k), k);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return {pos, lo, hi};
+    }
+
+    template<typename RandomIt>
+    RandomIt search_data(RandomIt start, const K &key) const {
+        auto [pos, lo, hi] = search(key);
+        if constexpr (BranchLessSearch) {
+            return search::lower_bound_branchless(start + lo, start + hi, key);
+        } else {
+            return std::lower_bound(start + lo, start + hi, key);
+        }
+    }
+
+    /**
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return levels.empty() ? 0 : levels[0].keys.size() - 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return levels.size(); }
+
+    /**
+     * Returns the size of the index in bytes, including the padding that aligns each array to a cache line.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const {
+        auto padded = [](size_t bytes) { return (bytes + 63) / 64 * 64; };
+        size_t bytes = levels.size() * sizeof(Level);
+        for (auto &level : levels)
+            bytes += padded(level.keys.size() * sizeof(K)) + padded(level.models.size() * sizeof(Model));
+        return bytes;
+    }
+};
+
+}
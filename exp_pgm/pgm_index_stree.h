@@ -0,0 +1,220 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "pgm_index.h"
+#include "pgm_index_soa.h"
+#include "search_algo.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace pgm {
+
+/**
+ * A hybrid index that keeps the last level of a PGM-index and replaces its recursive levels with a static search tree.
+ *
+ * The keys of the segments are the leaves of an implicit B+-tree (an S+-tree) whose nodes are cache lines of
+ * 64 / sizeof(K) keys and have one child more than keys. The nodes are stored layer by layer, from the root to the
+ * leaves, so no pointer is needed: the c-th child of the j-th node of a layer is the (j * (B + 1) + c)-th node of the
+ * next layer. Each node is searched by counting the keys <= the sought key with SIMD comparisons, so the traversal has
+ * no data-dependent branch and costs at most one cache miss per layer, whatever the distribution of the keys.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam Floating the floating-point type to use for slopes
+ */
+template<typename K, size_t Epsilon = 64, bool BranchLessSearch = false, typename Floating = float>
+class STreePGMIndex {
+protected:
+    static_assert(64 % sizeof(K) == 0, "The keys must pack a cache line");
+
+    using base_type = PGMIndex<K, Epsilon, 0, BranchLessSearch, 0, Floating>;
+
+    /// The number of keys in a node of the tree.
+    static constexpr size_t B = 64 / sizeof(K);
+
+    /// The largest key, reserved as a sentinel by @ref PGMIndex, which pads the nodes of the tree.
+    static constexpr K sentinel = std::numeric_limits<K>::has_infinity ? std::numeric_limits<K>::infinity()
+                                                                       : std::numeric_limits<K>::max();
+
+    struct Model {
+        Floating slope;     ///< The slope of the segment.
+        uint32_t intercept; ///< The intercept of the segment.
+    };
+
+    size_t n;                              ///< The number of elements this index was built on.
+    K first_key;                           ///< The smallest element.
+    size_t count;                          ///< The number of segments.
+    internal::aligned_vector<K> tree;      ///< The nodes of the tree, from the root to the leaves.
+    std::vector<size_t> layers_offsets;    ///< The starting position of each layer in tree[], from the root.
+    internal::aligned_vector<Model> models; ///< The model of each segment, followed by a sentinel.
+
+    /// Returns the number of keys <= key in the node starting at @p node.
+    static size_t rank(const K *node, const K &key) {
+        if constexpr (std::is_same_v<K, uint64_t>) {
+            return search::count_less_simd<true>(node, B, key);
+        } else {
+            size_t cnt = 0;
+            for (size_t i = 0; i < B; ++i)
+                cnt += node[i] <= key;
+            return cnt;
+        }
+    }
+
+    /**
+     * Returns the index of the segment responsible for a given key, that is, the rightmost segment having
+     * key <= the sought key.
+     */
+    size_t segment_for_key(const K &key) const {
+        auto k = std::min<K>(key, sentinel - 1);
+        size_t j = 0;
+        for (size_t h = 0; h + 1 < layers_offsets.size(); ++h)
+            j = j * (B + 1) + rank(tree.data() + layers_offsets[h] + j * B, k);
+        return j * B + rank(tree.data() + layers_offsets.back() + j * B, k) - 1;
+    }
+
+    /// Returns the approximate position of @p k according to the i-th segment.
+    size_t predict(size_t i, const K &k) const {
+        auto segment_key = tree[layers_offsets.back() + i];
+        size_t pos;
+        if constexpr (std::is_same_v<K, int64_t> || std::is_same_v<K, int32_t>)
+            pos = size_t(models[i].slope * double(std::make_unsigned_t<K>(k) - segment_key));
+        else
+            pos = size_t(models[i].slope * double(k - segment_key));
+        return std::min<size_t>(pos + models[i].intercept, models[i + 1].intercept);
+    }
+
+    void build(const std::vector<K> &keys) {
+        // Leaves: the keys of the segments, padded to a multiple of B
+        std::vector<std::vector<K>> layers(1, keys);
+        layers[0].resize((keys.size() + B - 1) / B * B, sentinel);
+
+        // Upper layers: the c-th key of a node is the smallest key in the subtree of its (c + 1)-th child
+        std::vector<K> mins;
+        for (size_t i = 0; i < layers[0].size(); i += B)
+            mins.push_back(layers[0][i]);
+        while (mins.size() > 1) {
+            auto nodes = (mins.size() + B) / (B + 1);
+            std::vector<K> layer(nodes * B, sentinel);
+            std::vector<K> next_mins(nodes);
+            for (size_t j = 0; j < nodes; ++j) {
+                next_mins[j] = mins[j * (B + 1)];
+                for (size_t c = 1; c <= B && j * (B + 1) + c < mins.size(); ++c)
+                    layer[j * B + c - 1] = mins[j * (B + 1) + c];
+            }
+            layers.push_back(std::move(layer));
+            mins = std::move(next_mins);
+        }
+
+        for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+            layers_offsets.push_back(tree.size());
+            tree.insert(tree.end(), it->begin(), it->end());
+        }
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty index.
+     */
+    STreePGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     */
+    explicit STreePGMIndex(const std::vector<K> &data) : STreePGMIndex(data.begin(), data.end()) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     */
+    template<typename RandomIt>
+    STreePGMIndex(RandomIt first, RandomIt last) : STreePGMIndex(base_type(first, last)) {}
+
+    /**
+     * Constructs the index with the same last level of a @ref PGMIndex.
+     * @param index the index to convert
+     */
+    template<size_t EpsilonRecursive, bool OtherBranchLessSearch, size_t linear_search_threshold>
+    explicit STreePGMIndex(const PGMIndex<K, Epsilon, EpsilonRecursive, OtherBranchLessSearch, linear_search_threshold, Floating> &index)
+        : n(index.size()), first_key(), count(0), tree(), layers_offsets(), models() {
+        auto segments = index.get_segments();
+        if (segments.empty())
+            return;
+
+        count = index.segments_count();
+        first_key = segments.front().key;
+        std::vector<K> keys(count);
+        models.reserve(count + 1);
+        for (size_t i = 0; i <= count; ++i) {
+            if (i < count)
+                keys[i] = segments[i].key;
+            models.push_back({segments[i].slope, segments[i].intercept});
+        }
+        build(keys);
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto pos = predict(segment_for_key(k), k);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        return {pos, lo, hi};
+    }
+
+    template<typename RandomIt>
+    RandomIt search_data(RandomIt start, const K &key) const {
+        auto [pos, lo, hi] = search(key);
+        if constexpr (BranchLessSearch) {
+            return search::lower_bound_branchless(start + lo, start + hi, key);
+        } else {
+            return std::lower_bound(start + lo, start + hi, key);
+        }
+    }
+
+    /**
+     * Returns the number of segments of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return count; }
+
+    /**
+     * Returns the number of layers of the tree over the segments.
+     * @return the number of layers of the tree
+     */
+    size_t tree_height() const { return layers_offsets.size(); }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const {
+        return tree.size() * sizeof(K) + models.size() * sizeof(Model) + layers_offsets.size() * sizeof(size_t);
+    }
+};
+
+}
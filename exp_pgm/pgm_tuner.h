@@ -0,0 +1,321 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "pgm_index_runtime.h"
+#include "piecewise_linear_model.h"
+#include "search_algo.h"
+#include "timer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace pgm {
+
+/**
+ * Chooses Epsilon and EpsilonRecursive for a dataset from a cost model, instead of benchmarking the whole grid.
+ *
+ * The size of the last level is predicted by segmenting a number of contiguous chunks spread over the dataset, and by
+ * scaling their segment counts to the whole dataset. The size of the upper levels is predicted by segmenting, level by
+ * level, a stride sample with one key per predicted segment. The latency of a lookup is predicted as the sum, over the levels, of the
+ * latency of a random access to a memory area as large as the level plus the search of its window, and of the cost
+ * of the last-mile search. These costs are calibrated on the machine: the memory latency by pointer chasing in buffers
+ * of increasing size, the last-mile search by searching windows of each size around the true positions of the query
+ * sample in the data. All of them are timed with timer.h, the per-query loops (the last-mile calibration and the
+ * verification of the candidates) with the method of --timing.
+ *
+ * @tparam K the type of the indexed keys
+ */
+template<typename K>
+class EpsilonTuner {
+public:
+    /// A configuration with its predicted (or measured) cost.
+    struct Candidate {
+        size_t epsilon;
+        size_t epsilon_recursive;
+        std::vector<size_t> levels; ///< The number of segments of each level, from the last one to the root.
+        size_t bytes;               ///< The size of the index in bytes.
+        double latency;             ///< The latency of search_data in nanoseconds.
+    };
+
+    /// The values considered for Epsilon and EpsilonRecursive.
+    std::vector<size_t> epsilons = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    std::vector<size_t> epsilons_recursive = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+    /**
+     * @param data the sorted keys to be indexed
+     * @param n the number of keys
+     * @param queries a sample of the queries
+     * @param sample_size the number of keys segmented to predict the size of the levels
+     * @param chunks the number of contiguous chunks of the sample
+     */
+    EpsilonTuner(const K *data, size_t n, const std::vector<K> &queries, size_t sample_size = size_t(1) << 22,
+                 size_t chunks = 64)
+        : data(data), n(n), queries(queries), sample_size(std::min(sample_size, n)), chunks(chunks) {}
+
+    /**
+     * Measures the memory latency and the last-mile search costs on this machine. Must be called before
+     * @ref predict.
+     */
+    void calibrate() {
+        for (size_t bytes = size_t(1) << 14; bytes <= max_chase_bytes; bytes <<= 2)
+            memory_latency.emplace_back(bytes, chase(bytes));
+        memory_latency.emplace_back(n * sizeof(K), data_latency());
+        std::sort(memory_latency.begin(), memory_latency.end());
+
+        std::vector<size_t> positions(queries.size());
+        for (size_t i = 0; i < queries.size(); ++i)
+            positions[i] = std::lower_bound(data, data + n, queries[i]) - data;
+        for (auto e : epsilons) {
+            evict_caches();
+            last_mile_latency.push_back(last_mile(positions, e));
+        }
+        for (auto e : epsilons_recursive)
+            level_search_latency.push_back(level_search(e));
+    }
+
+    /**
+     * Returns the predicted size of the levels, size and latency of the index with the given epsilon values. Throws
+     * std::invalid_argument if they are not among the calibrated @ref epsilons and @ref epsilons_recursive.
+     */
+    Candidate predict(size_t epsilon, size_t epsilon_recursive) const {
+        Candidate c{epsilon, epsilon_recursive, {last_level_segments(epsilon)}, 0, 0};
+
+        // The upper levels are built, as in PGMIndex, on a stride sample of one key every n / segments keys, which
+        // follows the same distribution as the first keys of the segments
+        std::vector<K> keys(c.levels.back());
+        for (size_t i = 0; i < keys.size(); ++i)
+            keys[i] = data[size_t(double(i) * n / keys.size())];
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        while (c.levels.back() > 1) {
+            std::vector<K> next;
+            auto in = [&](size_t i) { return keys[i]; };
+            auto out = [&](const auto &cs) { next.push_back(cs.get_first_x()); };
+            c.levels.push_back(keys.size() > 1 ? internal::make_segmentation(keys.size(), epsilon_recursive, in, out) : 1);
+            keys = std::move(next);
+        }
+
+        for (auto l : c.levels)
+            c.bytes += (l + 2) * segment_bytes;
+        c.bytes += (c.levels.size() + 1) * sizeof(size_t);
+
+        auto e = std::find(epsilons.begin(), epsilons.end(), epsilon) - epsilons.begin();
+        auto er = std::find(epsilons_recursive.begin(), epsilons_recursive.end(), epsilon_recursive) - epsilons_recursive.begin();
+        if (size_t(e) == epsilons.size() || size_t(er) == epsilons_recursive.size())
+            throw std::invalid_argument("epsilon values must be among the calibrated epsilons");
+        c.latency = last_mile_latency[e];
+        for (size_t l = 0; l + 1 < c.levels.size(); ++l)
+            c.latency += latency_of((c.levels[l] + 2) * segment_bytes) + level_search_latency[er];
+        return c;
+    }
+
+    /// Returns the predictions of all the pairs of @ref epsilons and @ref epsilons_recursive.
+    std::vector<Candidate> predict_all() const {
+        std::vector<Candidate> all;
+        for (auto e : epsilons)
+            for (auto er : epsilons_recursive)
+                all.push_back(predict(e, er));
+        return all;
+    }
+
+    /**
+     * Returns the candidates that fit in @p max_bytes, the fastest first. If none fits, returns the smallest one.
+     */
+    std::vector<Candidate> rank_for_memory(size_t max_bytes) const {
+        auto all = predict_all();
+        std::vector<Candidate> fit;
+        std::copy_if(all.begin(), all.end(), std::back_inserter(fit), [&](auto &c) { return c.bytes <= max_bytes; });
+        if (fit.empty())
+            return {*std::min_element(all.begin(), all.end(), [](auto &a, auto &b) { return a.bytes < b.bytes; })};
+        std::sort(fit.begin(), fit.end(), [](auto &a, auto &b) { return a.latency < b.latency; });
+        return fit;
+    }
+
+    /**
+     * Returns the candidates whose latency is at most @p max_latency nanoseconds, the smallest first. If none is fast
+     * enough, returns the fastest one.
+     */
+    std::vector<Candidate> rank_for_latency(double max_latency) const {
+        auto all = predict_all();
+        std::vector<Candidate> fit;
+        std::copy_if(all.begin(), all.end(), std::back_inserter(fit), [&](auto &c) { return c.latency <= max_latency; });
+        if (fit.empty())
+            return {*std::min_element(all.begin(), all.end(), [](auto &a, auto &b) { return a.latency < b.latency; })};
+        std::sort(fit.begin(), fit.end(), [](auto &a, auto &b) { return a.bytes < b.bytes; });
+        return fit;
+    }
+
+    /**
+     * Builds the index of a candidate and measures its size and the latency of search_data on the query sample.
+     */
+    Candidate measure(const Candidate &c) const {
+        RuntimePGMIndex<K, true, 8> index(data, data + n, c.epsilon, c.epsilon_recursive);
+        K res = 0;
+        auto duration = timer::time_queries(queries, [&](K q) { return res += *index.search_data(data, q); });
+        sink = res;
+        return {c.epsilon, c.epsilon_recursive, index.get_levels_segment_count(), index.size_in_bytes(),
+                double(duration) / queries.size()};
+    }
+
+    /// Returns the calibrated latency of a random access to an area of @p bytes bytes, in nanoseconds.
+    double latency_of(size_t bytes) const {
+        if (bytes <= memory_latency.front().first)
+            return memory_latency.front().second;
+        for (size_t i = 1; i < memory_latency.size(); ++i) {
+            auto [b0, l0] = memory_latency[i - 1];
+            auto [b1, l1] = memory_latency[i];
+            if (bytes <= b1 || i + 1 == memory_latency.size()) {
+                auto t = std::clamp((std::log2(double(bytes)) - std::log2(double(b0))) / (std::log2(double(b1)) - std::log2(double(b0))), 0.0, 1.0);
+                return l0 + t * (l1 - l0);
+            }
+        }
+        return memory_latency.back().second;
+    }
+
+protected:
+    static constexpr size_t segment_bytes = 16;
+    static constexpr size_t max_chase_bytes = size_t(1) << 28;
+    static constexpr size_t evict_bytes = size_t(1) << 27;
+
+    const K *data;
+    size_t n;
+    std::vector<K> queries;
+    size_t sample_size;
+    size_t chunks;
+    std::vector<std::pair<size_t, double>> memory_latency; ///< (bytes, latency) pairs, increasing.
+    std::vector<double> last_mile_latency;                 ///< The last-mile cost of each of the epsilons.
+    std::vector<double> level_search_latency;              ///< The in-cache window search cost of each of the epsilons_recursive.
+    mutable K sink = 0;
+
+    /**
+     * Returns the number of segments of the last level, predicted by segmenting contiguous chunks spread over the data.
+     * The last segment of each chunk is cut by the end of the chunk, so only the complete ones are counted, together
+     * with the keys they cover. The chunks are large enough to hold several segments even for large epsilon values.
+     */
+    size_t last_level_segments(size_t epsilon) const {
+        auto c = std::clamp<size_t>(sample_size / (512 * epsilon), 1, chunks);
+        auto chunk_size = std::max<size_t>(2, sample_size / c);
+        size_t segments = 0, covered = 0;
+        for (size_t j = 0; j < c; ++j) {
+            auto start = c == 1 ? 0 : j * (n - chunk_size) / (c - 1);
+            std::vector<K> first_keys;
+            auto in = [&](size_t i) { return data[i]; };
+            auto out = [&](const auto &cs) { first_keys.push_back(cs.get_first_x()); };
+            internal::make_segmentation(n, start, start + chunk_size, epsilon, in, out);
+            segments += first_keys.size() - 1;
+            covered += std::lower_bound(data + start, data + start + chunk_size, first_keys.back()) - (data + start);
+        }
+        if (segments == 0)
+            return std::max<size_t>(1, n / (c * chunk_size));
+        return std::max<size_t>(1, double(segments) * n / covered);
+    }
+
+    /// Returns the latency of dependent random accesses to a buffer of the given size.
+    static double chase(size_t bytes) {
+        constexpr size_t line = 64 / sizeof(size_t);
+        auto lines = bytes / 64;
+        std::vector<size_t> next(lines * line);
+        std::vector<size_t> order(lines);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+        for (size_t i = 0; i < lines; ++i)
+            next[order[i] * line] = order[(i + 1) % lines] * line;
+
+        const size_t steps = 1 << 20;
+        size_t p = 0;
+        for (size_t i = 0; i < std::min(steps, lines); ++i)
+            p = next[p];
+        auto duration = timer::time([&] {
+            for (size_t i = 0; i < steps; ++i)
+                p = next[p];
+        });
+        if (p == size_t(-1))
+            std::abort();
+        return double(duration) / steps;
+    }
+
+    /// Returns the latency of dependent random accesses to the data.
+    double data_latency() const {
+        const size_t steps = 1 << 20;
+        uint64_t h = 0;
+        auto duration = timer::time([&] {
+            for (size_t i = 0; i < steps; ++i)
+                h = (h ^ uint64_t(data[(h * 0x9E3779B97F4A7C15ull + i) % n])) * 0xff51afd7ed558ccdull;
+        });
+        sink += K(h);
+        return double(duration) / steps;
+    }
+
+    /// Reads a buffer larger than the last-level cache, so that the data touched by the query sample is evicted.
+    void evict_caches() const {
+        std::vector<uint64_t> buffer(evict_bytes / sizeof(uint64_t), 1);
+        sink += K(std::accumulate(buffer.begin(), buffer.end(), uint64_t(0)));
+    }
+
+    /**
+     * Returns the cost of a last-mile search in windows of 2 * epsilon + 2 keys around the given positions, displaced
+     * by a random error of at most epsilon.
+     */
+    double last_mile(const std::vector<size_t> &positions, size_t epsilon) const {
+        std::mt19937_64 gen(7);
+        std::vector<std::pair<size_t, size_t>> windows(positions.size());
+        for (size_t i = 0; i < positions.size(); ++i) {
+            auto pos = std::min(n - 1, PGM_SUB_EPS(positions[i], epsilon) + std::uniform_int_distribution<size_t>(0, 2 * epsilon)(gen));
+            windows[i] = {PGM_SUB_EPS(pos, epsilon), PGM_ADD_EPS(pos, epsilon, n)};
+        }
+
+        std::vector<size_t> samples(positions.size());
+        std::iota(samples.begin(), samples.end(), 0);
+        K res = 0;
+        auto duration = timer::time_queries(samples, [&](size_t i) {
+            return res += *search::lower_bound_branchless(data + windows[i].first, data + windows[i].second, queries[i]);
+        });
+        sink += res;
+        return double(duration) / positions.size();
+    }
+
+    /// Returns the cost of searching an in-cache window of 2 * epsilon_recursive + 3 segment keys.
+    double level_search(size_t epsilon_recursive) const {
+        auto w = 2 * epsilon_recursive + 3;
+        std::vector<K> keys(w);
+        std::iota(keys.begin(), keys.end(), K(0));
+        const size_t steps = 1 << 16;
+        std::mt19937_64 gen(11);
+        K res = 0;
+        auto duration = timer::time([&] {
+            for (size_t i = 0; i < steps; ++i) {
+                K key = gen() % w;
+                if (epsilon_recursive <= 8) {
+                    size_t j = 0;
+                    for (; j + 1 < w && keys[j + 1] <= key; ++j)
+                        continue;
+                    res += j;
+                } else {
+                    res += *search::upper_bound_branchless(keys.begin(), keys.end(), key);
+                }
+            }
+        });
+        sink += res;
+        return double(duration) / steps;
+    }
+};
+
+}
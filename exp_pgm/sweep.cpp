@@ -0,0 +1,281 @@
+//
+//  sweep.cpp
+//  bench_search
+//
+//  Sweeps any grid of (Epsilon, EpsilonRecursive) with the runtime-configured
+//  PGM-index, without compiling one benchmark per grid point.
+//
+//  ./sweep data_file result_file [--eps=4,8,16] [--eps-rec=4,8] [--nq=5000] [--repeat=10] [--config=grid.cfg]
+//          [--threads[=1,2,4]] [--layout=cores|smt|sockets] [--throughput-nq=1048576]
+//
+//  --threads also measures the throughput of every grid point, and of a binary
+//  search on the whole data, on each number of threads (by default the powers
+//  of two up to the number of CPUs) pinned with the layout of throughput.h, each
+//  thread with its own stream of --throughput-nq random keys. The results go to
+//  result_file with _throughput before its extension.
+//
+//  A config file holds the same options, one per line and without the leading
+//  dashes (e.g. "eps=4,8,16"); lines starting with # are ignored.
+//
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include "pgm_index_runtime.h"
+#include "page_alloc.h"
+#include "histogram.h"
+#include "perf_counters.h"
+#include "throughput.h"
+#include "utils.h"
+
+
+struct sweep_config {
+    std::vector<size_t> eps_l = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    std::vector<size_t> eps_i = {4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    size_t nq = 5000;
+    size_t repeat = 10;
+    std::vector<size_t> threads;
+    throughput::Layout layout = throughput::Layout::cores;
+    size_t throughput_nq = 1 << 20;
+};
+
+std::vector<size_t> parse_list(const std::string& s) {
+    std::vector<size_t> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty())
+            values.push_back(std::stoull(item));
+    }
+    return values;
+}
+
+void parse_option(sweep_config& cfg, const std::string& opt);
+
+void parse_config_file(sweep_config& cfg, const std::string& fname) {
+    std::ifstream in(fname);
+    if (!in.is_open()) {
+        std::cerr << "unable to open " << fname << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+        if (!line.empty() && line[0] != '#')
+            parse_option(cfg, line);
+    }
+}
+
+void parse_option(sweep_config& cfg, const std::string& opt) {
+    auto eq = opt.find('=');
+    auto key = opt.substr(0, eq);
+    auto value = eq == std::string::npos ? "" : opt.substr(eq + 1);
+    if (key == "eps")
+        cfg.eps_l = parse_list(value);
+    else if (key == "eps-rec")
+        cfg.eps_i = parse_list(value);
+    else if (key == "nq")
+        cfg.nq = std::stoull(value);
+    else if (key == "repeat")
+        cfg.repeat = std::stoull(value);
+    else if (key == "config")
+        parse_config_file(cfg, value);
+    else if (key == "threads")
+        cfg.threads = value.empty() ? throughput::default_thread_counts() : parse_list(value);
+    else if (key == "layout")
+        cfg.layout = throughput::parse_layout(value);
+    else if (key == "throughput-nq")
+        cfg.throughput_nq = std::stoull(value);
+    else
+        std::cerr << "unknown option " << opt << std::endl;
+}
+
+
+struct stats {
+    size_t eps_l;
+    size_t eps_i;
+    size_t levels;
+    size_t bytes;
+    size_t lls;
+    size_t ils;
+    size_t latency_branchy_i;
+    size_t latency_branchless_i;
+    size_t latency_branchy_l;
+    size_t latency_branchless_l;
+    perf::Phases counters_branchy;
+    perf::Phases counters_branchless;
+    hist::Summary tail_branchy_l;
+    hist::Summary tail_branchless_l;
+};
+
+
+/// Returns the latency without and with the last-mile search, done by last_mile(lo, hi, key), the counters of both
+/// phases, and the percentiles of the latency with the last-mile search.
+template<typename Index, typename LastMile>
+auto bench_index(const Index& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, const std::string& name, LastMile last_mile) {
+    auto nq = queries.size();
+    uint64_t res = 0;
+
+    // without last-mile search
+    size_t duration = timer::time_queries(queries, [&](uint64_t q) { return res = index.search(q).pos; });
+
+    // with last-mile search
+    hist::Histogram hist_l;
+    size_t duration_l = timer::time_queries(queries, [&](uint64_t q) { return res = *index.search_data(data.begin(), q); },
+                                            [&](uint64_t ns) { hist_l.record(ns); });
+
+    std::cout << "Search result: " << res << std::endl;
+    std::cout << "Query latency (pgm index " << name << ") " << duration / nq << std::endl;
+    std::cout << "Query latency all (pgm index " << name << ") " << duration_l / nq << std::endl;
+    if (hist_l.count())
+        std::cout << "Query latency all (pgm index " << name << ") " << hist::describe(hist_l.summary()) << std::endl;
+
+    auto phases = perf::measure_phases(queries,
+                                       [&](uint64_t q) { return index.search(q); },
+                                       [&](uint64_t q, pgm::ApproxPos p) { return last_mile(data.begin() + p.lo, data.begin() + p.hi, q); });
+    std::cout << "Counters per lookup (pgm index " << name << ") inference: " << perf::describe(phases.inference) << std::endl;
+    std::cout << "Counters per lookup (pgm index " << name << ") last mile: " << perf::describe(phases.last_mile) << std::endl;
+    return std::make_tuple(duration / nq, duration_l / nq, phases, hist_l.summary());
+}
+
+
+auto bench_pgm(const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries, size_t eps_l, size_t eps_i) {
+    std::cout << "===========================================" << std::endl;
+    std::cout << "Construct PGM index eps_l=" << eps_l << " eps_i=" << eps_i << std::endl;
+
+    std::vector<uint64_t> queries_cpy(queries);
+    pgm::RuntimePGMIndex<uint64_t, true, 8, float> index_branchless(data.begin(), data.end()-1, eps_l, eps_i);
+    auto [branchless_i, branchless_l, counters_branchless, tail_branchless_l] = bench_index(index_branchless, data, queries_cpy, "branchless", [](auto lo, auto hi, uint64_t q) {
+        return search::lower_bound_branchless(lo, hi, q);
+    });
+
+    queries_cpy = queries;
+    pgm::RuntimePGMIndex<uint64_t, false, 0, float> index(data.begin(), data.end()-1, eps_l, eps_i);
+    auto [branchy_i, branchy_l, counters_branchy, tail_branchy_l] = bench_index(index, data, queries_cpy, "branchy", [](auto lo, auto hi, uint64_t q) {
+        return std::lower_bound(lo, hi, q);
+    });
+
+    std::cout << "PGM levels " << index.height()
+              << " bytes " << index.size_in_bytes()
+              << " LLS " << index.segments_count()
+              << " ILS " << index.internal_segments_count() << std::endl;
+
+    return stats {eps_l, eps_i, index.height(), index.size_in_bytes(), index.segments_count(), index.internal_segments_count(), branchy_i, branchless_i, branchy_l, branchless_l, counters_branchy, counters_branchless, tail_branchy_l, tail_branchless_l};
+}
+
+
+/// Returns the name of the throughput results: the latency results with _throughput before the extension.
+std::string throughput_file(const std::string& result_file) {
+    auto dot = result_file.find_last_of('.');
+    auto slash = result_file.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return result_file + "_throughput";
+    return result_file.substr(0, dot) + "_throughput" + result_file.substr(dot);
+}
+
+/// Writes the throughput of a binary search and of the PGM-indexes of the grid on each number of threads of cfg.
+void bench_throughput(const sweep_config& cfg, const mem::vector<uint64_t>& data, const std::string& filename) {
+    std::ofstream ofs(filename);
+    ofs << "index,eps_l,eps_i,bytes," << throughput::header() << std::endl;
+    auto streams = [&](size_t t) { return throughput::random_stream(data, cfg.throughput_nq, t + 1); };
+
+    auto run = [&](const std::string& name, size_t eps_l, size_t eps_i, size_t bytes, auto lookup) {
+        for (auto t : cfg.threads) {
+            auto r = throughput::run(t, cfg.layout, streams, lookup);
+            std::cout << "Throughput (" << name << " eps_l=" << eps_l << " eps_i=" << eps_i << ") threads " << t
+                      << " " << r.mops() << " Mops/s" << std::endl;
+            ofs << name << "," << eps_l << "," << eps_i << "," << bytes << ",";
+            throughput::write(ofs, cfg.layout, r);
+            ofs << std::endl;
+        }
+    };
+
+    run("binary", 0, 0, 0, [&](uint64_t q) { return std::lower_bound(data.begin(), data.end(), q); });
+    for (auto eps_i : cfg.eps_i) {
+        for (auto eps_l : cfg.eps_l) {
+            pgm::RuntimePGMIndex<uint64_t, true, 8, float> index_branchless(data.begin(), data.end()-1, eps_l, eps_i);
+            run("branchless", eps_l, eps_i, index_branchless.size_in_bytes(), [&](uint64_t q) { return index_branchless.search_data(data.begin(), q); });
+            pgm::RuntimePGMIndex<uint64_t, false, 0, float> index(data.begin(), data.end()-1, eps_l, eps_i);
+            run("branchy", eps_l, eps_i, index.size_in_bytes(), [&](uint64_t q) { return index.search_data(data.begin(), q); });
+        }
+    }
+    ofs.close();
+}
+
+
+int main(int argc, const char * argv[]) {
+    auto args = timer::parse_args(mem::parse_args(argc, argv));
+    sweep_config cfg;
+    std::vector<std::string> files;
+    for (auto& arg : args) {
+        if (arg.rfind("--", 0) == 0)
+            parse_option(cfg, arg.substr(2));
+        else
+            files.push_back(arg);
+    }
+    if (files.size() < 2) {
+        std::cerr << "usage: " << argv[0] << " data_file result_file [--eps=4,8] [--eps-rec=4,8] [--nq=N] [--repeat=N] [--config=file] [--threads[=1,2,4]] [--layout=cores|smt|sockets] [--throughput-nq=N]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Load data from " << files[0] << " on " << mem::to_string(mem::policy().pages) << " pages" << std::endl;
+    std::cout << "Timing: " << timer::describe() << std::endl;
+    auto data = benchmark::load_data<uint64_t, mem::Allocator<uint64_t>>(files[0]);
+    std::sort(data.begin(), data.end());
+
+    std::vector<std::pair<size_t, stats>> bench_results;
+
+    for (size_t i=0; i<cfg.repeat; ++i) {
+        std::cout << "Round " << i << std::endl;
+        std::cout << "Generate " << cfg.nq << " random search keys." << std::endl;
+        auto queries = benchmark::gen_random_queries(data, cfg.nq);
+
+        for (auto eps_i : cfg.eps_i) {
+            for (auto eps_l : cfg.eps_l) {
+                bench_results.emplace_back(i, bench_pgm(data, queries, eps_l, eps_i));
+            }
+        }
+    }
+
+    std::ofstream ofs(files[1]);
+    ofs << "round,pages,timing,eps_l,eps_i,levels,bytes,lls,ils,latency_branchy_i,latency_branchy_l,latency_branchless_i,latency_branchless_l";
+    for (auto v : {"branchy", "branchless"}) {
+        ofs << "," << perf::header("", std::string("_") + v + "_inference")
+            << "," << perf::header("", std::string("_") + v + "_last_mile");
+    }
+    ofs << "," << hist::header("latency_branchy_l_") << "," << hist::header("latency_branchless_l_");
+    ofs << std::endl;
+    for (auto br : bench_results) {
+        ofs << br.first << ","
+            << mem::to_string(mem::policy().pages) << ","
+            << timer::to_string(timer::method()) << ","
+            << br.second.eps_l << ","
+            << br.second.eps_i << ","
+            << br.second.levels << ","
+            << br.second.bytes << ","
+            << br.second.lls << ","
+            << br.second.ils << ","
+            << br.second.latency_branchy_i << ","
+            << br.second.latency_branchy_l << ","
+            << br.second.latency_branchless_i << ","
+            << br.second.latency_branchless_l << ","
+            << br.second.counters_branchy.inference << ","
+            << br.second.counters_branchy.last_mile << ","
+            << br.second.counters_branchless.inference << ","
+            << br.second.counters_branchless.last_mile << ","
+            << br.second.tail_branchy_l << ","
+            << br.second.tail_branchless_l << std::endl;
+    }
+    ofs.close();
+
+    if (!cfg.threads.empty())
+        bench_throughput(cfg, data, throughput_file(files[1]));
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+//
+//  throughput.h
+//  bench_search
+//
+//  Throughput of lookups on several threads pinned to cores.
+//
+//  One thread measures latency, not capacity: learned indexes and binary
+//  search saturate the memory bandwidth at different numbers of cores. run()
+//  below starts one thread per core of a layout, pins it, lets it draw its
+//  own query stream (allocated by the thread, so on its NUMA node), and then
+//  releases all the threads at once and reports the aggregate lookups per
+//  second from the release to the end of the last thread.
+//
+//  The layouts (--layout=cores|smt|sockets) order the CPUs the process may
+//  run on, from the topology in /sys/devices/system/cpu:
+//  - cores takes one hardware thread per physical core, socket after socket,
+//    and the SMT siblings only once every core has a thread;
+//  - smt takes the SMT siblings of a core together, core after core;
+//  - sockets takes one hardware thread per core, alternating the sockets.
+//  Beyond the number of CPUs the threads wrap around and share them.
+//
+
+#ifndef throughput_h
+#define throughput_h
+
+#include <algorithm>
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "timer.h"
+
+namespace throughput {
+
+enum class Layout {
+    cores,   ///< one thread per physical core first, socket after socket
+    smt,     ///< the SMT siblings of a core together
+    sockets, ///< one thread per physical core, alternating the sockets
+};
+
+inline std::string to_string(Layout l) {
+    switch (l) {
+        case Layout::smt: return "smt";
+        case Layout::sockets: return "sockets";
+        default: return "cores";
+    }
+}
+
+inline Layout parse_layout(const std::string &s) {
+    if (s == "smt") return Layout::smt;
+    if (s == "sockets") return Layout::sockets;
+    if (s != "cores")
+        std::cerr << "unknown thread layout " << s << ", one thread per core" << std::endl;
+    return Layout::cores;
+}
+
+/// A hardware thread the process may run on.
+struct Cpu {
+    int id;
+    int core;    ///< The core_id of the CPU in its package.
+    int package; ///< The physical_package_id (socket) of the CPU.
+};
+
+namespace internal {
+
+inline int read_topology(int cpu, const std::string &name) {
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+    int value = -1;
+    in >> value;
+    return value;
+}
+
+}
+
+/// Returns the CPUs the process may run on. Without topology information, every CPU is a core of package 0.
+inline std::vector<Cpu> topology() {
+    std::vector<Cpu> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (!CPU_ISSET(i, &set))
+                continue;
+            auto core = internal::read_topology(i, "core_id");
+            auto package = internal::read_topology(i, "physical_package_id");
+            cpus.push_back({i, core < 0 ? i : core, std::max(package, 0)});
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        for (int i = 0; i < int(std::max(1u, std::thread::hardware_concurrency())); ++i)
+            cpus.push_back({i, i, 0});
+    }
+    return cpus;
+}
+
+/// Returns the ids of the CPUs in the order in which the threads of the layout take them.
+inline std::vector<int> cpu_order(Layout layout) {
+    // The hardware threads of every core, cores in (package, core) order.
+    std::map<std::pair<int, int>, std::vector<int>> cores;
+    for (auto &c : topology())
+        cores[{c.package, c.core}].push_back(c.id);
+
+    std::vector<int> order;
+    if (layout == Layout::smt) {
+        for (auto &[key, siblings] : cores)
+            order.insert(order.end(), siblings.begin(), siblings.end());
+        return order;
+    }
+
+    // Rank of every core in its package, for the alternation of Layout::sockets.
+    std::vector<std::tuple<size_t, int, int, const std::vector<int> *>> ranked; // (rank, package, core, siblings)
+    std::map<int, size_t> rank;
+    for (auto &[key, siblings] : cores)
+        ranked.emplace_back(rank[key.first]++, key.first, key.second, &siblings);
+    if (layout == Layout::sockets)
+        std::sort(ranked.begin(), ranked.end());
+
+    size_t max_siblings = 0;
+    for (auto &[key, siblings] : cores)
+        max_siblings = std::max(max_siblings, siblings.size());
+    for (size_t s = 0; s < max_siblings; ++s)
+        for (auto &r : ranked)
+            if (s < std::get<3>(r)->size())
+                order.push_back((*std::get<3>(r))[s]);
+    return order;
+}
+
+/// Pins the calling thread to a CPU. Returns false if it cannot.
+inline bool pin(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+/// Returns the thread counts of a scaling curve: the powers of two below the number of CPUs, and the number of CPUs.
+inline std::vector<size_t> default_thread_counts() {
+    std::vector<size_t> counts;
+    auto n = topology().size();
+    for (size_t t = 1; t < n; t *= 2)
+        counts.push_back(t);
+    counts.push_back(n);
+    return counts;
+}
+
+/// Returns a stream of n keys drawn uniformly from the data, different for every seed.
+template<typename Data>
+std::vector<typename Data::value_type> random_stream(const Data &data, size_t n, uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<size_t> dis(0, data.size() - 1);
+    std::vector<typename Data::value_type> stream(n);
+    for (auto &k : stream)
+        k = data[dis(gen)];
+    return stream;
+}
+
+struct Result {
+    size_t threads;
+    std::vector<int> cpus; ///< The CPU of every thread.
+    uint64_t lookups;      ///< The lookups of all the threads.
+    uint64_t ns;           ///< The time from the release of the threads to the end of the last one.
+
+    /// Returns the aggregate throughput in millions of lookups per second.
+    double mops() const { return ns ? lookups * 1e3 / ns : 0; }
+
+    /// Returns the CPUs separated by semicolons, for a CSV column.
+    std::string cpu_list() const {
+        std::string s;
+        for (auto c : cpus)
+            s += (s.empty() ? "" : ";") + std::to_string(c);
+        return s;
+    }
+};
+
+/// Returns the CSV header of the results of @ref write.
+inline std::string header() {
+    return "layout,threads,cpus,lookups,time,mops";
+}
+
+/// Writes a result in the columns of @ref header.
+inline void write(std::ostream &os, Layout layout, const Result &r) {
+    os << to_string(layout) << "," << r.threads << "," << r.cpu_list() << "," << r.lookups << "," << r.ns << ","
+       << r.mops();
+}
+
+/**
+ * Runs lookups on @p threads threads pinned to the first CPUs of @p layout, and returns their aggregate throughput.
+ * @param make_queries make_queries(t) returns the query stream of thread t; it is called on the pinned thread, before
+ * the timing starts
+ * @param lookup lookup(q) looks up a query; it is called concurrently by all the threads
+ */
+template<typename MakeQueries, typename Lookup>
+Result run(size_t threads, Layout layout, MakeQueries &&make_queries, Lookup &&lookup) {
+    auto order = cpu_order(layout);
+    Result result{threads, {}, 0, 0};
+    for (size_t t = 0; t < threads; ++t)
+        result.cpus.push_back(order[t % order.size()]);
+    if (threads > order.size())
+        std::cerr << threads << " threads share " << order.size() << " CPUs" << std::endl;
+
+    std::barrier ready(ptrdiff_t(threads + 1));
+    std::vector<uint64_t> counts(threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            if (!pin(result.cpus[t]))
+                std::cerr << "cannot pin thread " << t << " to CPU " << result.cpus[t] << std::endl;
+            auto queries = make_queries(t);
+            ready.arrive_and_wait();
+            for (auto &q : queries)
+                timer::do_not_optimize(lookup(q));
+            counts[t] = queries.size();
+        });
+    }
+    ready.arrive_and_wait();
+    auto start = timer::start();
+    for (auto &w : workers)
+        w.join();
+    result.ns = timer::sample(start);
+    for (auto c : counts)
+        result.lookups += c;
+    return result;
+}
+
+}
+
+#endif /* throughput_h */
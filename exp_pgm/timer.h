@@ -0,0 +1,235 @@
+//
+//  timer.h
+//  bench_search
+//
+//  Timing of the lookups with the time-stamp counter.
+//
+//  A lookup takes 20-100 ns, about as long as the two clock reads that would
+//  time it with std::chrono, whose cost and serialization then end up in the
+//  latency. The timer below reads the TSC instead, serialized so that the
+//  lookup can neither start before the first read nor retire after the second
+//  one, and converts ticks to nanoseconds with a frequency calibrated against
+//  std::chrono::steady_clock once per process.
+//
+//  The per-query loops of the benchmarks are timed with one of two methods
+//  (--timing=batched|sampled):
+//  - batched times the whole loop with a single pair of reads and divides it by
+//    the number of queries. The lookups overlap as they would in a real loop;
+//  - sampled times every query on its own, which gives the distribution of the
+//    latencies, and subtracts the overhead of a pair of reads, measured at the
+//    calibration, from every sample.
+//
+//  Without an invariant TSC (or off x86), the ticks are the nanoseconds of
+//  steady_clock, and the overhead is measured the same way.
+//
+
+#ifndef timer_h
+#define timer_h
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TIMER_TSC 1
+#endif
+
+namespace timer {
+
+enum class Method {
+    batched, ///< time the whole query loop and divide it by the number of queries
+    sampled, ///< time every query and subtract the overhead of the timer from each sample
+};
+
+/// The method used by the per-query loops of the benchmarks.
+inline Method &method() {
+    static Method m = Method::sampled;
+    return m;
+}
+
+inline std::string to_string(Method m) {
+    return m == Method::batched ? "batched" : "sampled";
+}
+
+inline Method parse_method(const std::string &s) {
+    if (s == "batched") return Method::batched;
+    if (s != "sampled")
+        std::cerr << "unknown timing method " << s << ", sampling every query" << std::endl;
+    return Method::sampled;
+}
+
+/// Sets the method from the option --timing=batched|sampled, and returns the other arguments.
+inline std::vector<std::string> parse_args(const std::vector<std::string> &args) {
+    std::vector<std::string> rest;
+    for (auto &arg : args) {
+        if (arg.rfind("--timing=", 0) == 0)
+            method() = parse_method(arg.substr(9));
+        else
+            rest.push_back(arg);
+    }
+    return rest;
+}
+
+/// Keeps the compiler from dropping the computation of a value that is never used.
+template<typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+namespace internal {
+
+inline bool invariant_tsc() {
+#if defined(TIMER_TSC)
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007 || !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return false;
+    return edx & (1u << 8);
+#else
+    return false;
+#endif
+}
+
+inline uint64_t steady_ns() {
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+}
+
+struct Calibration {
+    bool tsc;            ///< Whether the ticks are those of the TSC, or the nanoseconds of steady_clock.
+    double ticks_per_ns; ///< The frequency of the ticks.
+    uint64_t overhead;   ///< The least number of ticks between a start() and a stop() with nothing in between.
+};
+
+/// Returns the calibration of the timer, measured at the first call.
+inline const Calibration &calibration() {
+    static const Calibration c = [] {
+        Calibration c{internal::invariant_tsc(), 1.0, 0};
+        if (!c.tsc)
+            std::cerr << "no invariant TSC, timing with steady_clock" << std::endl;
+#if defined(TIMER_TSC)
+        if (c.tsc) {
+            const uint64_t window = 50'000'000;
+            auto ns0 = internal::steady_ns();
+            auto t0 = __rdtsc();
+            uint64_t ns1;
+            while ((ns1 = internal::steady_ns()) - ns0 < window) {}
+            auto t1 = __rdtsc();
+            c.ticks_per_ns = double(t1 - t0) / double(ns1 - ns0);
+        }
+#endif
+        return c;
+    }();
+    return c;
+}
+
+/// Returns the ticks at the start of a timed section: no instruction after it runs before the read.
+inline uint64_t start() {
+#if defined(TIMER_TSC)
+    if (calibration().tsc) {
+        _mm_lfence();
+        uint64_t t = __rdtsc();
+        _mm_lfence();
+        return t;
+    }
+#endif
+    return internal::steady_ns();
+}
+
+/// Returns the ticks at the end of a timed section: the read waits for all the instructions before it.
+inline uint64_t stop() {
+#if defined(TIMER_TSC)
+    if (calibration().tsc) {
+        unsigned aux;
+        uint64_t t = __rdtscp(&aux);
+        _mm_lfence();
+        return t;
+    }
+#endif
+    return internal::steady_ns();
+}
+
+/// Returns the overhead of a start() and a stop() in ticks, measured at the first call.
+inline uint64_t overhead() {
+    static const uint64_t o = [] {
+        uint64_t least = UINT64_MAX;
+        for (int i = 0; i < 10000; ++i) {
+            auto t = start();
+            least = std::min(least, stop() - t);
+        }
+        return least;
+    }();
+    return o;
+}
+
+/// Converts ticks to nanoseconds.
+inline uint64_t to_ns(uint64_t ticks) {
+    return uint64_t(ticks / calibration().ticks_per_ns + 0.5);
+}
+
+/// Returns the nanoseconds since @p begin, a value of start(), without the overhead of the timer.
+inline uint64_t sample(uint64_t begin) {
+    auto end = stop();
+    auto ticks = end - begin;
+    return to_ns(ticks > overhead() ? ticks - overhead() : 0);
+}
+
+/// Returns the time of fn() in nanoseconds.
+template<typename F>
+uint64_t time(F &&fn) {
+    overhead();
+    auto t = start();
+    fn();
+    return sample(t);
+}
+
+/**
+ * Returns the total time of fn(q) over the queries in nanoseconds, with the method of the benchmarks. The results of fn
+ * are kept alive so that no lookup is optimized away. With Method::sampled, @p on_sample is called with the time of
+ * each query.
+ */
+template<typename Queries, typename F, typename OnSample>
+uint64_t time_queries(const Queries &queries, F &&fn, OnSample &&on_sample) {
+    overhead();
+    if (method() == Method::batched) {
+        return time([&] {
+            for (auto &q : queries)
+                do_not_optimize(fn(q));
+        });
+    }
+    uint64_t total = 0;
+    for (auto &q : queries) {
+        auto t = start();
+        do_not_optimize(fn(q));
+        auto ns = sample(t);
+        on_sample(ns);
+        total += ns;
+    }
+    return total;
+}
+
+template<typename Queries, typename F>
+uint64_t time_queries(const Queries &queries, F &&fn) {
+    return time_queries(queries, fn, [](uint64_t) {});
+}
+
+/// Describes the timer, e.g. "sampled, TSC at 2.90 GHz, overhead 12 ns".
+inline std::string describe() {
+    auto &c = calibration();
+    std::string s = to_string(method()) + ", ";
+    if (c.tsc)
+        s += "TSC at " + std::to_string(c.ticks_per_ns).substr(0, 4) + " GHz, ";
+    else
+        s += "steady_clock, ";
+    return s + "overhead " + std::to_string(to_ns(overhead())) + " ns";
+}
+
+}
+
+#endif /* timer_h */
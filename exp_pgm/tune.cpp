@@ -0,0 +1,129 @@
+//
+//  tune.cpp
+//  bench_search
+//
+//  Picks (Epsilon, EpsilonRecursive) for a dataset with the cost model of
+//  pgm_tuner.h, under a memory budget or a latency target, and verifies the
+//  choice with a short benchmark.
+//
+//  ./tune data_file result_file (--memory=BYTES | --latency=NS) [--nq=5000] [--sample=4194304] [--verify=3]
+//
+//  --verify=N measures at most N (at least 1) of the best candidates, in order,
+//  until one meets the constraint.
+//
+//  The result file lists the prediction of every candidate and the measured
+//  size and latency of the verified ones.
+//
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include "pgm_tuner.h"
+#include "page_alloc.h"
+#include "utils.h"
+
+
+struct tune_config {
+    size_t memory = 0;
+    double latency = 0;
+    size_t nq = 5000;
+    size_t sample = size_t(1) << 22;
+    size_t verify = 3;
+};
+
+void parse_option(tune_config& cfg, const std::string& opt) {
+    auto eq = opt.find('=');
+    auto key = opt.substr(0, eq);
+    auto value = eq == std::string::npos ? "" : opt.substr(eq + 1);
+    if (key == "memory")
+        cfg.memory = std::stoull(value);
+    else if (key == "latency")
+        cfg.latency = std::stod(value);
+    else if (key == "nq")
+        cfg.nq = std::stoull(value);
+    else if (key == "sample")
+        cfg.sample = std::stoull(value);
+    else if (key == "verify")
+        cfg.verify = std::stoull(value);
+    else
+        std::cerr << "unknown option " << opt << std::endl;
+}
+
+
+int main(int argc, const char * argv[]) {
+    auto args = timer::parse_args(mem::parse_args(argc, argv));
+    tune_config cfg;
+    std::vector<std::string> files;
+    for (auto& arg : args) {
+        if (arg.rfind("--", 0) == 0)
+            parse_option(cfg, arg.substr(2));
+        else
+            files.push_back(arg);
+    }
+    if (files.size() < 2 || (cfg.memory == 0) == (cfg.latency == 0) || cfg.verify == 0) {
+        std::cerr << "usage: " << argv[0] << " data_file result_file (--memory=BYTES | --latency=NS) [--nq=N] [--sample=N] [--verify=N, N >= 1]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Load data from " << files[0] << " on " << mem::to_string(mem::policy().pages) << " pages" << std::endl;
+    std::cout << "Timing: " << timer::describe() << std::endl;
+    auto data = benchmark::load_data<uint64_t, mem::Allocator<uint64_t>>(files[0]);
+    std::sort(data.begin(), data.end());
+    auto queries = benchmark::gen_random_queries(data, cfg.nq);
+
+    // The last key is left out of the index, as in main.cpp and sweep.cpp
+    pgm::EpsilonTuner<uint64_t> tuner(data.data(), data.size() - 1, queries, cfg.sample);
+    std::cout << "Calibrate" << std::endl;
+    tuner.calibrate();
+    std::cout << "Memory latency (ns): 16KB " << tuner.latency_of(size_t(1) << 14)
+              << " 1MB " << tuner.latency_of(size_t(1) << 20)
+              << " 64MB " << tuner.latency_of(size_t(1) << 26)
+              << " data " << tuner.latency_of(data.size() * sizeof(uint64_t)) << std::endl;
+
+    auto all = tuner.predict_all();
+    auto ranked = cfg.memory ? tuner.rank_for_memory(cfg.memory) : tuner.rank_for_latency(cfg.latency);
+    auto meets = [&](auto& c) { return cfg.memory ? c.bytes <= cfg.memory : c.latency <= cfg.latency; };
+    if (!meets(ranked.front()))
+        std::cout << "No configuration is predicted to meet the constraint, trying the closest one" << std::endl;
+
+    // Verify the best candidates in order, until one meets the constraint when measured
+    std::vector<std::pair<decltype(all)::value_type, decltype(all)::value_type>> verified;
+    for (size_t i = 0; i < std::min(cfg.verify, ranked.size()); ++i) {
+        auto& c = ranked[i];
+        auto m = tuner.measure(c);
+        std::cout << "eps_l=" << c.epsilon << " eps_i=" << c.epsilon_recursive
+                  << " predicted bytes " << c.bytes << " latency " << c.latency
+                  << " measured bytes " << m.bytes << " latency " << m.latency << std::endl;
+        verified.emplace_back(c, m);
+        if (meets(m))
+            break;
+    }
+
+    auto& chosen = verified.back();
+    std::cout << "Chosen eps_l=" << chosen.first.epsilon << " eps_i=" << chosen.first.epsilon_recursive
+              << (meets(chosen.second) ? "" : " (does not meet the constraint)") << std::endl;
+
+    std::ofstream ofs(files[1]);
+    ofs << "pages,eps_l,eps_i,levels,predicted_bytes,predicted_latency,measured_bytes,measured_latency,chosen" << std::endl;
+    for (auto& c : all) {
+        auto v = std::find_if(verified.begin(), verified.end(), [&](auto& p) {
+            return p.first.epsilon == c.epsilon && p.first.epsilon_recursive == c.epsilon_recursive;
+        });
+        ofs << mem::to_string(mem::policy().pages) << ","
+            << c.epsilon << ","
+            << c.epsilon_recursive << ","
+            << c.levels.size() << ","
+            << c.bytes << ","
+            << c.latency << ",";
+        if (v != verified.end())
+            ofs << v->second.bytes << "," << v->second.latency << ",";
+        else
+            ofs << ",,";
+        ofs << (v != verified.end() && v + 1 == verified.end()) << std::endl;
+    }
+    ofs.close();
+
+    return 0;
+}
@@ -10,20 +10,18 @@
 
 #include <random>
 #include <numeric>
+#include "timer.h"
 
 namespace benchmark {
 static uint64_t timing(std::function<void()> fn) {
-    const auto start = std::chrono::high_resolution_clock::now();
-    fn();
-    const auto end = std::chrono::high_resolution_clock::now();
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return timer::time(fn);
 }
 
 
 // Loads values from binary file into vector.
-template <typename T>
-static std::vector<T> load_data(const std::string& filename, bool print = true, size_t sample_size = 0) {
-    std::vector<T> data;
+template <typename T, typename Alloc = std::allocator<T>>
+static std::vector<T, Alloc> load_data(const std::string& filename, bool print = true, size_t sample_size = 0) {
+    std::vector<T, Alloc> data;
     const uint64_t ns = timing([&] {
         std::ifstream in(filename, std::ios::binary);
         if (!in.is_open()) {
@@ -49,7 +47,7 @@ static std::vector<T> load_data(const std::string& filename, bool print = true,
     if (sample_size > 0) {
         std::random_device rd;
         std::mt19937 gen(rd());
-        std::vector<T> sample;
+        std::vector<T, Alloc> sample;
         std::sample(data.begin(), data.end()-1, std::back_inserter(sample), sample_size, gen);
         return sample;
     } else {
@@ -79,8 +77,8 @@ void save_data(const std::vector<K>& data, const std::string& filename, bool pri
 }
 
 
-template <typename K>
-auto get_data_stats(const std::vector<K>& data) {
+template <typename K, typename Alloc>
+auto get_data_stats(const std::vector<K, Alloc>& data) {
     std::vector<K> gaps;
     for (auto i=1; i<data.size()-1; ++i) {
         gaps.emplace_back(data[i]-data[i-1]);
@@ -121,8 +119,8 @@ std::vector<uint64_t> gen_random_keys_on_gaps(const size_t& n, const uint64_t& m
     return data;
 }
 
-template<typename K>
-std::vector<K> gen_random_queries(const std::vector<K>& data, const size_t& nq) {
+template<typename K, typename Alloc>
+std::vector<K> gen_random_queries(const std::vector<K, Alloc>& data, const size_t& nq) {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::vector<K> sample;
@@ -1,5 +1,6 @@
 #include "books_800M_uint64_0.h"
 #include "books_800M_uint64_0_data.h"
+#include "page_alloc.h"
 #include <math.h>
 #include <cmath>
 #include <fstream>
@@ -8,18 +9,12 @@
 namespace books_800M_uint64_0 {
 char* L1_PARAMETERS = nullptr; 
 bool load(char const* dataPath) {
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "books_800M_uint64_0_L1_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L1_PARAMETERS = (char*) malloc(402653184);
-    if (L1_PARAMETERS == NULL) return false;
-    infile.read((char*)L1_PARAMETERS, 402653184);
-    if (!infile.good()) return false;
-  }
+  L1_PARAMETERS = (char*) mem::load_file(std::filesystem::path(dataPath) / "books_800M_uint64_0_L1_PARAMETERS", 402653184);
+  if (L1_PARAMETERS == NULL) return false;
   return true;
 }
 void cleanup() {
-    free(L1_PARAMETERS);
+    mem::deallocate(L1_PARAMETERS);
 }
 
 inline double linear(double alpha, double beta, double inp) {
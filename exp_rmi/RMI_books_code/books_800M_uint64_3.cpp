@@ -1,5 +1,6 @@
 #include "books_800M_uint64_3.h"
 #include "books_800M_uint64_3_data.h"
+#include "page_alloc.h"
 #include <math.h>
 #include <cmath>
 #include <fstream>
@@ -9,27 +10,15 @@ namespace books_800M_uint64_3 {
 char* L1_PARAMETERS = nullptr; 
 uint32_t* L0_PARAMETERS = nullptr; 
 bool load(char const* dataPath) {
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "books_800M_uint64_3_L0_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L0_PARAMETERS = (uint32_t*) malloc(16777216);
-    if (L0_PARAMETERS == NULL) return false;
-    infile.read((char*)L0_PARAMETERS, 16777216);
-    if (!infile.good()) return false;
-  }
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "books_800M_uint64_3_L1_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L1_PARAMETERS = (char*) malloc(25165824);
-    if (L1_PARAMETERS == NULL) return false;
-    infile.read((char*)L1_PARAMETERS, 25165824);
-    if (!infile.good()) return false;
-  }
+  L0_PARAMETERS = (uint32_t*) mem::load_file(std::filesystem::path(dataPath) / "books_800M_uint64_3_L0_PARAMETERS", 16777216);
+  if (L0_PARAMETERS == NULL) return false;
+  L1_PARAMETERS = (char*) mem::load_file(std::filesystem::path(dataPath) / "books_800M_uint64_3_L1_PARAMETERS", 25165824);
+  if (L1_PARAMETERS == NULL) return false;
   return true;
 }
 void cleanup() {
-    free(L0_PARAMETERS);
-    free(L1_PARAMETERS);
+    mem::deallocate(L0_PARAMETERS);
+    mem::deallocate(L1_PARAMETERS);
 }
 
 inline uint64_t radix_table(const uint32_t* table, const uint64_t inp) {
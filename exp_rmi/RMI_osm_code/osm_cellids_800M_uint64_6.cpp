@@ -1,5 +1,6 @@
 #include "osm_cellids_800M_uint64_6.h"
 #include "osm_cellids_800M_uint64_6_data.h"
+#include "page_alloc.h"
 #include <math.h>
 #include <cmath>
 #include <fstream>
@@ -9,27 +10,15 @@ namespace osm_cellids_800M_uint64_6 {
 char* L1_PARAMETERS = nullptr; 
 uint32_t* L0_PARAMETERS = nullptr;
 bool load(char const* dataPath) {
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "osm_cellids_800M_uint64_6_L0_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L0_PARAMETERS = (uint32_t*) malloc(1048576);
-    if (L0_PARAMETERS == NULL) return false;
-    infile.read((char*)L0_PARAMETERS, 1048576);
-    if (!infile.good()) return false;
-  }
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "osm_cellids_800M_uint64_6_L1_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L1_PARAMETERS = (char*) malloc(786432);
-    if (L1_PARAMETERS == NULL) return false;
-    infile.read((char*)L1_PARAMETERS, 786432);
-    if (!infile.good()) return false;
-  }
+  L0_PARAMETERS = (uint32_t*) mem::load_file(std::filesystem::path(dataPath) / "osm_cellids_800M_uint64_6_L0_PARAMETERS", 1048576);
+  if (L0_PARAMETERS == NULL) return false;
+  L1_PARAMETERS = (char*) mem::load_file(std::filesystem::path(dataPath) / "osm_cellids_800M_uint64_6_L1_PARAMETERS", 786432);
+  if (L1_PARAMETERS == NULL) return false;
   return true;
 }
 void cleanup() {
-    free(L0_PARAMETERS);
-    free(L1_PARAMETERS);
+    mem::deallocate(L0_PARAMETERS);
+    mem::deallocate(L1_PARAMETERS);
 }
 
 inline double linear(double alpha, double beta, double inp) {
@@ -1,5 +1,6 @@
 #include "uniform_sparse_200M_uint64_3.h"
 #include "uniform_sparse_200M_uint64_3_data.h"
+#include "page_alloc.h"
 #include <math.h>
 #include <cmath>
 #include <fstream>
@@ -7,18 +8,12 @@
 #include <iostream>
 namespace uniform_sparse_200M_uint64_3 {
 bool load(char const* dataPath) {
-  {
-    std::ifstream infile(std::filesystem::path(dataPath) / "uniform_sparse_200M_uint64_3_L1_PARAMETERS", std::ios::in | std::ios::binary);
-    if (!infile.good()) return false;
-    L1_PARAMETERS = (char*) malloc(25165824);
-    if (L1_PARAMETERS == NULL) return false;
-    infile.read((char*)L1_PARAMETERS, 25165824);
-    if (!infile.good()) return false;
-  }
+  L1_PARAMETERS = (char*) mem::load_file(std::filesystem::path(dataPath) / "uniform_sparse_200M_uint64_3_L1_PARAMETERS", 25165824);
+  if (L1_PARAMETERS == NULL) return false;
   return true;
 }
 void cleanup() {
-    free(L1_PARAMETERS);
+    mem::deallocate(L1_PARAMETERS);
 }
 
 inline uint64_t radix(uint64_t prefix_length, uint64_t bits, uint64_t inp) {
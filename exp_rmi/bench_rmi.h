@@ -0,0 +1,354 @@
+//
+//  bench_rmi.h
+//  bench_search
+//
+//  Benchmark harness shared by the RMI mains (main_*/main_*.cpp).
+//
+
+#ifndef bench_rmi_h
+#define bench_rmi_h
+
+#include <cassert>
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include "search_algo.h"
+#include "utils.h"
+#include "rmi.h"
+#include "histogram.h"
+#include "page_alloc.h"
+#include "perf_counters.h"
+#include "timer.h"
+
+#if defined(__cpp_impl_coroutine)
+/// Interleaving degrees swept by the coroutine lookups.
+const std::vector<size_t> coro_degrees = {1, 2, 4, 8, 16, 32};
+#else
+const std::vector<size_t> coro_degrees = {};
+#endif
+
+/// The number of keys of a group of the batched lookups with prefetching.
+const size_t batch_group = 16;
+
+/// Whether a model has the batched lookups of TwoLevelRMI.
+template<typename Model, typename = void>
+struct has_batch : std::false_type {};
+
+template<typename Model>
+struct has_batch<Model, std::void_t<decltype(&Model::search_batch)>> : std::true_type {};
+
+
+bool file_exists(const std::string& filename) {
+    std::ifstream file(filename);
+    return file.good();
+}
+
+
+double rand_val(int seed) {
+    static bool first = true;
+    if (first) {
+        srand(seed == 0 ? time(NULL) : seed);
+        first = false;
+    }
+    return ((double) rand() / (double) RAND_MAX);
+}
+
+
+int zipf(double alpha, int n) {
+    static bool first = true;
+    static double c = 0;          // Normalization constant
+    static double *sum_probs;     // Pre-calculated sum of probabilities
+    double z;                     // Uniform random number (0 < z < 1)
+    int zipf_value;               // Computed exponential value to be returned
+    int i;                        // Loop counter
+    int low, high, mid;           // Binary-search bounds
+
+    // Compute normalization constant on first call only
+    if (first) {
+        for (i = 1; i <= n; i++) {
+            c = c + (1.0 / pow((double) i, alpha));
+        }
+        c = 1.0 / c;
+
+        sum_probs = (double *)malloc((n + 1) * sizeof(*sum_probs));
+        sum_probs[0] = 0;
+        for (i = 1; i <= n; i++) {
+            sum_probs[i] = sum_probs[i - 1] + c / pow((double) i, alpha);
+        }
+        first = false;
+    }
+
+    // Pull a uniform random number (0 < z < 1)
+    do {
+        z = rand_val(0);
+    } while ((z == 0) || (z == 1));
+
+    // Map z to the value
+    low = 1, high = n, mid = 0;
+    do {
+        mid = (low + high) / 2;
+        if (sum_probs[mid] >= z && sum_probs[mid - 1] < z) {
+            zipf_value = mid;
+            break;
+        } else if (sum_probs[mid] >= z) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    } while (low <= high);
+
+    // Assert that zipf_value is between 1 and N
+    assert((zipf_value >= 1) && (zipf_value <= n));
+
+    return zipf_value;
+}
+
+std::vector<uint64_t> gen_zipfian_queries(const mem::vector<uint64_t>& data, size_t nq, double alpha) {
+    std::vector<uint64_t> queries;
+    queries.reserve(nq);
+
+    for (size_t i = 0; i < nq; ++i) {
+        int index = zipf(alpha, data.size()) - 1;
+        queries.push_back(data[index]);
+    }
+
+    return queries;
+}
+
+void append_results_to_csv(const std::string& filename, size_t round, size_t search_time, size_t total_time, size_t err_total, size_t err_max, size_t nq, size_t rmi_size, size_t loop_time, const hist::Summary& tail, const std::vector<size_t>& coro_times, const std::vector<size_t>& batch_times, const std::vector<size_t>& last_mile_times, const perf::Phases& counters, const std::string& variant) {
+    std::ofstream file;
+    bool exists = file_exists(filename);
+    file.open(filename, std::ios::out | std::ios::app);
+    if (file.is_open()) {
+        if (!exists) {
+            file << "round,RMI search time,RMI total time,RMI avg error,RMI max error,RMI size,RMI loop time," << hist::header("RMI ", " time");
+            for (auto d : coro_degrees) {
+                file << ",RMI coro" << d << " time";
+            }
+            file << ",RMI batch time,RMI batch prefetch time";
+            for (auto s : search::last_miles) {
+                file << ",RMI " << search::to_string(s) << " time";
+            }
+            file << "," << perf::header("RMI inference ") << "," << perf::header("RMI last-mile ");
+            file << ",pages,timing";
+            if (!variant.empty()) {
+                file << ",variant";
+            }
+            file << "\n";
+        }
+        file << round << ","
+             << search_time / nq << ","
+             << total_time / nq << ","
+             << err_total / nq << ","
+             << err_max << ","
+             << rmi_size << ","
+             << loop_time / nq << ","
+             << tail;
+        for (auto t : coro_times) {
+            file << "," << t / nq;
+        }
+        file << ",";
+        if (!batch_times.empty()) {
+            file << batch_times[0] / nq;
+        }
+        file << ",";
+        if (!batch_times.empty()) {
+            file << batch_times[1] / nq;
+        }
+        for (auto t : last_mile_times) {
+            file << "," << t / nq;
+        }
+        file << "," << counters.inference << "," << counters.last_mile;
+        file << "," << mem::to_string(mem::policy().pages) << "," << timer::to_string(timer::method());
+        if (!variant.empty()) {
+            file << "," << variant;
+        }
+        file << "\n";
+        file.close();
+    } else {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+    }
+}
+
+/**
+ * Returns the range of the last-mile search of q, and its error in err: the range of a lookup_range-like lookup, whose
+ * error is half its width, or the window [res - err, res + err) of a lookup returning a position and its error.
+ */
+template<typename Lookup>
+rmi::Range lookup_window(const Lookup& lookup, uint64_t q, size_t size, size_t* err) {
+    if constexpr (std::is_invocable_v<const Lookup&, uint64_t>) {
+        auto r = lookup(q);
+        *err = (r.hi - r.lo + 1) / 2;
+        return r;
+    } else {
+        auto res = lookup(q, err);
+        return rmi::Range::around(res, *err, size);
+    }
+}
+
+/**
+ * Runs the lookups of `repeat` query samples.
+ *
+ * Each sample is first run one lookup at a time with the generated lookup function, timed with
+ * timer::time_queries: first with the last-mile search, then for the RMI inference alone on a fresh
+ * sample, so that each pass is the first over its queries. With the sampled method, the latencies of
+ * the former go to a hist::Histogram, whose p50, p90, p99, p99.9 and max are reported; the batched method has no percentiles. The whole sample is then timed as a
+ * plain loop, as coroutine lookups on the split model, sweeping the interleaving degree, and, if the model
+ * has them, as the batched lookups of TwoLevelRMI: lookup_batch followed by the last-mile searches, and
+ * search_batch, which prefetches the leaves and the last-mile ranges of groups of keys. The hardware
+ * counters of the inference and of the last-mile search are counted per lookup in two more loops
+ * (perf::measure_phases). Finally, the plain loop is timed with each last-mile strategy of
+ * search::last_miles.
+ *
+ * lookup is the generated lookup function, or any callable with the same signature, or a callable
+ * returning the rmi::Range of a key like TwoLevelRMI::lookup_range. When variant is not empty, it is
+ * appended to the results as a last column.
+ */
+template<typename Lookup, typename Model>
+void run_tests(const mem::vector<uint64_t>& data, size_t nq, size_t repeat, const std::string& filename,
+               const std::function<std::vector<uint64_t>(const mem::vector<uint64_t>&, size_t)>& gen_queries,
+               Lookup lookup, size_t rmi_size, const Model& model, const std::string& variant = "") {
+    std::cout << "Timing: " << timer::describe() << std::endl;
+    for (size_t i = 0; i < repeat; ++i) {
+        auto queries = gen_queries(data, nq);
+        size_t err_total = 0;
+        size_t err_max = 0;
+        hist::Histogram latencies;
+
+        auto total_time = timer::time_queries(queries, [&](uint64_t q) {
+            size_t err = 0;
+            auto r = lookup_window(lookup, q, data.size(), &err);
+            return std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, q);
+        }, [&](uint64_t ns) { latencies.record(ns); });
+        // A sample of its own, so that neither pass finds the leaves left in the caches by the other.
+        auto inference_queries = gen_queries(data, nq);
+        auto search_time = timer::time_queries(inference_queries, [&](uint64_t q) {
+            size_t err = 0;
+            return lookup_window(lookup, q, data.size(), &err);
+        });
+        for (auto q : queries) {
+            size_t err = 0;
+            lookup_window(lookup, q, data.size(), &err);
+            err_total += err;
+            err_max = err > err_max ? err : err_max;
+        }
+        auto tail = latencies.summary();
+
+        std::vector<size_t> results(nq);
+        auto loop_time = benchmark::timing([&] {
+            for (size_t j = 0; j < nq; ++j) {
+                size_t err = 0;
+                auto r = lookup_window(lookup, queries[j], data.size(), &err);
+                results[j] = std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, queries[j]) - data.begin();
+            }
+        });
+
+        std::vector<size_t> coro_times;
+#if defined(__cpp_impl_coroutine)
+        for (auto d : coro_degrees) {
+            size_t mismatches = 0;
+            coro_times.push_back(benchmark::timing([&] {
+                coro::interleave(d, nq,
+                                 [&](size_t j) { return model.search_coro(data.data(), data.size(), queries[j]); },
+                                 [&](size_t j, size_t pos) { mismatches += pos != results[j]; });
+            }));
+            if (mismatches > 0) {
+                std::cerr << "coroutine lookups differ from lookup() on " << mismatches << " queries" << std::endl;
+            }
+        }
+#endif
+
+        std::vector<size_t> batch_times;
+        if constexpr (has_batch<Model>::value) {
+            std::vector<uint64_t> pos(nq);
+            std::vector<size_t> errs(nq), out(nq);
+            size_t mismatches = 0;
+            batch_times.push_back(benchmark::timing([&] {
+                model.lookup_batch(queries.data(), nq, pos.data(), errs.data());
+                for (size_t j = 0; j < nq; ++j) {
+                    auto r = rmi::Range::around(pos[j], errs[j], data.size());
+                    out[j] = std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, queries[j]) - data.begin();
+                }
+            }));
+            mismatches += out != results;
+            batch_times.push_back(benchmark::timing([&] {
+                model.search_batch(data.data(), data.size(), queries.data(), nq, out.data(), batch_group);
+            }));
+            mismatches += out != results;
+            if (mismatches > 0) {
+                std::cerr << "batched lookups differ from lookup()" << std::endl;
+            }
+        }
+
+        auto counters = perf::measure_phases(queries, [&](uint64_t q) {
+            size_t err = 0;
+            return lookup_window(lookup, q, data.size(), &err);
+        }, [&](uint64_t q, rmi::Range r) {
+            return std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, q);
+        });
+
+        std::vector<size_t> last_mile_times;
+        auto edges = search::edge_keys(data.begin(), data.end());
+        for (auto s : search::last_miles) {
+            size_t mismatches = 0;
+            last_mile_times.push_back(search::with_last_mile(s, [&](auto strategy) {
+                auto find = [&](uint64_t q) {
+                    size_t err = 0;
+                    auto r = lookup_window(lookup, q, data.size(), &err);
+                    return search::last_mile<decltype(strategy)::value>(data.begin() + r.lo, data.begin() + r.hi,
+                                                                        data.begin() + r.pos, q);
+                };
+                auto time = benchmark::timing([&] {
+                    for (size_t j = 0; j < nq; ++j)
+                        mismatches += size_t(find(queries[j]) - data.begin()) != results[j];
+                });
+                // The windows at both ends of the data, untimed
+                for (auto q : edges)
+                    mismatches += find(q) != std::lower_bound(data.begin(), data.end(), q);
+                return time;
+            }));
+            if (mismatches > 0) {
+                std::cerr << search::to_string(s) << " last-mile search differs from std::lower_bound on " << mismatches << " queries" << std::endl;
+            }
+        }
+
+        std::cout << " Sample " << i << ": "
+                  << " RMI search time: " << search_time / nq
+                  << " RMI total time: " << total_time / nq
+                  << " RMI avg error: " << err_total / nq
+                  << " RMI max error: " << err_max
+                  << " RMI size: " << rmi_size
+                  << " RMI loop time: " << loop_time / nq;
+        if (tail.count) {
+            std::cout << " RMI p50 time: " << tail.p50
+                      << " RMI p90 time: " << tail.p90
+                      << " RMI p99 time: " << tail.p99
+                      << " RMI p999 time: " << tail.p999
+                      << " RMI max time: " << tail.max;
+        }
+        for (auto j = 0; j < coro_times.size(); ++j) {
+            std::cout << " RMI coro" << coro_degrees[j] << " time: " << coro_times[j] / nq;
+        }
+        if (!batch_times.empty()) {
+            std::cout << " RMI batch time: " << batch_times[0] / nq
+                      << " RMI batch prefetch time: " << batch_times[1] / nq;
+        }
+        for (auto j = 0; j < last_mile_times.size(); ++j) {
+            std::cout << " RMI " << search::to_string(search::last_miles[j]) << " time: " << last_mile_times[j] / nq;
+        }
+        std::cout << std::endl;
+        std::cout << " Counters per lookup, inference: " << perf::describe(counters.inference)
+                  << " last mile: " << perf::describe(counters.last_mile) << std::endl;
+
+        append_results_to_csv(filename, i, search_time, total_time, err_total, err_max, nq, rmi_size, loop_time, tail, coro_times, batch_times, last_mile_times, counters, variant);
+    }
+}
+
+#endif /* bench_rmi_h */
@@ -0,0 +1,175 @@
+//
+//  coro.h
+//  bench_search
+//
+//  Interleaved execution of lookups with C++20 coroutines.
+//
+//  A lookup is written as a coroutine that prefetches the address it is about to
+//  load and suspends (co_await coro::prefetch(addr)). The scheduler keeps a
+//  group of such lookups in flight and resumes them round-robin, so the memory
+//  latency of one lookup is hidden behind the work of the others.
+//
+
+#ifndef coro_h
+#define coro_h
+
+#if defined(__cpp_impl_coroutine)
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace coro {
+
+/**
+ * A free list of fixed-size blocks backing the coroutine frames, so that starting a lookup
+ * does not go through the general-purpose allocator.
+ */
+class FramePool {
+    static constexpr size_t block_size = 512;
+    struct Block { Block *next; };
+    Block *head = nullptr;
+
+public:
+    ~FramePool() {
+        while (head) {
+            auto next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+
+    void *allocate(size_t size) {
+        if (size > block_size)
+            return ::operator new(size);
+        if (!head)
+            return ::operator new(block_size);
+        auto b = head;
+        head = head->next;
+        return b;
+    }
+
+    void deallocate(void *p, size_t size) {
+        if (size > block_size) {
+            ::operator delete(p);
+            return;
+        }
+        auto b = static_cast<Block *>(p);
+        b->next = head;
+        head = b;
+    }
+
+    static FramePool &local() {
+        thread_local FramePool pool;
+        return pool;
+    }
+};
+
+/**
+ * A lazily started coroutine computing a value of type T. It is driven by resume() until done().
+ */
+template<typename T>
+class Task {
+public:
+    struct promise_type {
+        T value;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { throw; }
+
+        static void *operator new(size_t size) { return FramePool::local().allocate(size); }
+        static void operator delete(void *p, size_t size) { FramePool::local().deallocate(p, size); }
+    };
+
+    Task() = default;
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&t) noexcept : handle(std::exchange(t.handle, nullptr)) {}
+    Task &operator=(Task &&t) noexcept {
+        if (this != &t) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(t.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool done() const { return handle.done(); }
+    void resume() { handle.resume(); }
+    T &result() { return handle.promise().value; }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+    std::coroutine_handle<promise_type> handle = nullptr;
+};
+
+/**
+ * Awaitable that issues a prefetch for an address and yields to the scheduler.
+ */
+struct prefetch {
+    const void *addr;
+
+    explicit prefetch(const void *addr) : addr(addr) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<>) const noexcept { __builtin_prefetch(addr); }
+    void await_resume() const noexcept {}
+};
+
+/**
+ * Runs @p n lookups with at most @p degree of them in flight, resuming them round-robin.
+ * @param degree the interleaving degree, i.e. the number of concurrent lookups
+ * @param n the number of lookups
+ * @param make_task a function that returns the task of the i-th lookup
+ * @param on_result a function called with the index and the result of each finished lookup
+ */
+template<typename MakeTask, typename OnResult>
+void interleave(size_t degree, size_t n, MakeTask make_task, OnResult on_result) {
+    using task_type = decltype(make_task(size_t(0)));
+    if (n == 0)
+        return;
+    degree = std::max<size_t>(1, std::min(degree, n));
+    std::vector<task_type> tasks(degree);
+    std::vector<size_t> ids(degree);
+
+    size_t next = 0, running = 0;
+    for (; next < degree; ++next, ++running) {
+        tasks[next] = make_task(next);
+        ids[next] = next;
+    }
+
+    while (running > 0) {
+        for (size_t s = 0; s < degree; ++s) {
+            auto &t = tasks[s];
+            if (ids[s] == n)
+                continue;
+            t.resume();
+            if (!t.done())
+                continue;
+            on_result(ids[s], t.result());
+            if (next < n) {
+                t = make_task(next);
+                ids[s] = next++;
+            } else {
+                t = task_type();
+                ids[s] = n;
+                --running;
+            }
+        }
+    }
+}
+
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* coro_h */
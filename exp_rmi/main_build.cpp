@@ -0,0 +1,201 @@
+//
+//  main_build.cpp
+//  bench_search
+//
+//  Retrains the RMI variants of a description file in process (see
+//  rmi_builder.h), reports the build throughput for several thread counts, and
+//  compares the lookups of the built models with the shipped parameter files.
+//
+//  ./main_build RMI_fb_code/fb_200M_uint64.rmi [--variants=fb_200M_uint64_0] [--threads=1,2,4,8] [--nq=10000]
+//               [--three-level=256:65536,4096:1048576]
+//
+//  --three-level also builds each variant as three-level RMIs with the same
+//  root, and MID models in the middle layer over LEAVES leaves, and writes the
+//  size, the error and the lookup time of the two- and three-level models to
+//  result/<dataset>_levels_results.csv, to compare them at equal size.
+//
+//  The builder fits linear leaves only, so the variants with cubic leaves are
+//  rebuilt with linear ones, and those with a radix_table root with a radix
+//  root of the same branching factor (or a linear root, if it is not a power
+//  of two).
+//
+
+#include <sstream>
+#include "bench_rmi.h"
+#include "rmi_builder.h"
+#include "rmi_runtime.h"
+
+
+struct lookup_stats {
+    size_t avg_err = 0;
+    size_t max_err = 0;
+    size_t lookup_time = 0;
+};
+
+/// Runs the queries with the last-mile search of the benchmark harness.
+lookup_stats bench_lookups(const rmi::RuntimeRMI& index, const mem::vector<uint64_t>& data, const std::vector<uint64_t>& queries) {
+    lookup_stats s;
+    size_t err_total = 0;
+    size_t res = 0;
+    index.visit([&](const auto& model) {
+        s.lookup_time = benchmark::timing([&] {
+            for (auto q : queries) {
+                size_t err = 0;
+                auto pred = model.lookup(q, &err);
+                size_t lower_bound_index = (pred > err) ? pred - err : 0;
+                size_t upper_bound_index = (pred + err < data.size()) ? pred + err : data.size() - 1;
+                res += std::lower_bound(data.begin() + lower_bound_index, data.begin() + upper_bound_index, q) - data.begin();
+                err_total += err;
+                s.max_err = std::max(s.max_err, err);
+            }
+        }) / queries.size();
+    });
+    s.avg_err = err_total / queries.size();
+    std::cout << "Search result: " << res << std::endl;
+    return s;
+}
+
+std::vector<size_t> parse_list(const std::string& s) {
+    std::vector<size_t> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(std::stoull(item));
+    return values;
+}
+
+
+int main(int argc, const char * argv[]) {
+    auto args = timer::parse_args(mem::parse_args(argc, argv));
+    size_t nq = 10000;
+    std::vector<size_t> threads = {1, 2, 4, 8};
+    std::vector<std::string> variants;
+    std::vector<std::pair<size_t, size_t>> levels;
+    std::string description_file;
+    for (auto& arg : args) {
+        if (arg.rfind("--nq=", 0) == 0) {
+            nq = std::stoull(arg.substr(5));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            threads = parse_list(arg.substr(10));
+        } else if (arg.rfind("--variants=", 0) == 0) {
+            std::stringstream ss(arg.substr(11));
+            std::string v;
+            while (std::getline(ss, v, ','))
+                variants.push_back(v);
+        } else if (arg.rfind("--three-level=", 0) == 0) {
+            std::stringstream ss(arg.substr(14));
+            std::string v;
+            while (std::getline(ss, v, ',')) {
+                auto colon = v.find(':');
+                if (colon == std::string::npos) {
+                    std::cerr << "invalid --three-level entry " << v << ", expected MID:LEAVES" << std::endl;
+                    return 1;
+                }
+                levels.emplace_back(std::stoull(v.substr(0, colon)), std::stoull(v.substr(colon + 1)));
+            }
+        } else {
+            description_file = arg;
+        }
+    }
+    if (description_file.empty()) {
+        std::cerr << "usage: " << argv[0] << " description_file [--variants=a,b] [--threads=1,2,4] [--nq=N] [--three-level=MID:LEAVES,...]" << std::endl;
+        return 1;
+    }
+
+    auto descriptions = rmi::load_descriptions(description_file);
+    const std::string fname = descriptions.dataset;
+
+    std::cout << "Load data from " << fname << " on " << mem::to_string(mem::policy().pages) << " pages" << std::endl;
+    auto data = benchmark::load_data<uint64_t, mem::Allocator<uint64_t>>(fname);
+    std::sort(data.begin(), data.end());
+    auto queries = benchmark::gen_random_queries(data, nq);
+
+    std::ofstream ofs("result/" + fname + "_build_results.csv");
+    ofs << "variant,l0,branching,threads,build_time,keys_per_s,size,avg_err,max_err,lookup_time,shipped_avg_err,shipped_max_err,shipped_lookup_time,pages" << std::endl;
+
+    std::ofstream levels_ofs;
+    if (!levels.empty()) {
+        levels_ofs.open("result/" + fname + "_levels_results.csv");
+        levels_ofs << "variant,levels,l0,mid_branching,branching,size,avg_err,max_err,lookup_time" << std::endl;
+    }
+
+    for (auto& d : descriptions.variants) {
+        if (!variants.empty() && std::find(variants.begin(), variants.end(), d.name) == variants.end())
+            continue;
+
+        auto l0 = d.l0;
+        if (l0 == "radix_table")
+            l0 = (d.branching & (d.branching - 1)) == 0 ? "radix" : "linear";
+
+        // The shipped model, if its parameter files are there
+        bool shipped = false;
+        lookup_stats shipped_stats;
+        try {
+            rmi::RuntimeRMI index(d, descriptions.parameters);
+            shipped_stats = bench_lookups(index, data, queries);
+            shipped = true;
+        } catch (const std::runtime_error& e) {
+            std::cout << "No shipped model: " << e.what() << std::endl;
+        }
+
+        for (auto t : threads) {
+            std::cout << "Build " << d.name << " l0 " << l0 << " branching " << d.branching << " threads " << t << std::endl;
+            auto start = std::chrono::high_resolution_clock::now();
+            auto index = rmi::build(data.data(), data.size(), l0, d.branching, t, d.name);
+            auto end = std::chrono::high_resolution_clock::now();
+            auto build_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            auto keys_per_s = size_t(data.size() / (build_time / 1e9));
+            auto s = bench_lookups(index, data, queries);
+
+            std::cout << "Build time (ns) " << build_time << " keys/s " << keys_per_s
+                      << " avg error " << s.avg_err << " max error " << s.max_err << " lookup time " << s.lookup_time;
+            if (shipped) {
+                std::cout << " shipped avg error " << shipped_stats.avg_err << " max error " << shipped_stats.max_err
+                          << " lookup time " << shipped_stats.lookup_time;
+            }
+            std::cout << std::endl;
+
+            ofs << d.name << ","
+                << l0 << ","
+                << d.branching << ","
+                << t << ","
+                << build_time << ","
+                << keys_per_s << ","
+                << index.size_in_bytes() << ","
+                << s.avg_err << ","
+                << s.max_err << ","
+                << s.lookup_time << ",";
+            if (shipped)
+                ofs << shipped_stats.avg_err << "," << shipped_stats.max_err << "," << shipped_stats.lookup_time << ",";
+            else
+                ofs << ",,,";
+            ofs << mem::to_string(mem::policy().pages) << std::endl;
+        }
+
+        if (levels.empty())
+            continue;
+
+        auto index = rmi::build(data.data(), data.size(), l0, d.branching, 0, d.name);
+        auto s = bench_lookups(index, data, queries);
+        levels_ofs << d.name << ",2," << l0 << ",0," << d.branching << "," << index.size_in_bytes() << ","
+                   << s.avg_err << "," << s.max_err << "," << s.lookup_time << std::endl;
+
+        for (auto [mid, leaves] : levels) {
+            std::cout << "Build " << d.name << " l0 " << l0 << " mid " << mid << " leaves " << leaves << std::endl;
+            try {
+                auto layered = rmi::build_three_level(data.data(), data.size(), l0, mid, leaves, 0, d.name);
+                auto s = bench_lookups(layered, data, queries);
+                std::cout << "Size " << layered.size_in_bytes() << " avg error " << s.avg_err << " max error " << s.max_err
+                          << " lookup time " << s.lookup_time << std::endl;
+                levels_ofs << d.name << ",3," << l0 << "," << mid << "," << leaves << "," << layered.size_in_bytes() << ","
+                           << s.avg_err << "," << s.max_err << "," << s.lookup_time << std::endl;
+            } catch (const std::exception& e) {
+                std::cout << "Three levels " << mid << ":" << leaves << ": " << e.what() << std::endl;
+            }
+        }
+    }
+    ofs.close();
+    levels_ofs.close();
+
+    return 0;
+}
@@ -0,0 +1,348 @@
+//
+//  main_runtime.cpp
+//  bench_search
+//
+//  Runs every RMI variant of a description file (see rmi_runtime.h) in one
+//  process, on a single loaded copy of the dataset.
+//
+//  ./main_runtime RMI_fb_code/fb_200M_uint64.rmi [--variants=fb_200M_uint64_0,fb_200M_uint64_3] [--nq=10000] [--repeat=10]
+//                 [--leaves=compact12,compact8] [--bounds] [--merge=64M,32M] [--hybrid=256,1024] [--hybrid-epsilon=32]
+//                 [--threads[=1,2,4]] [--layout=cores|smt|sockets] [--throughput-nq=1048576]
+//
+//  --leaves also runs each variant with its leaves re-encoded in the compact
+//  layouts of rmi.h, and writes the size and the error of every layout to
+//  result/<dataset>_leaves_results.csv.
+//
+//  --bounds also runs each variant with the asymmetric bounds of its leaves
+//  (rmi::fit_bounds), searching lookup_range() instead of [res - err, res + err).
+//
+//  --merge also runs each variant with its leaves merged to fit in each byte
+//  budget (rmi::merge_leaves; K, M and G suffixes are powers of 1024), and
+//  writes the size, the number of leaves and the error of the merged models to
+//  result/<dataset>_merge_results.csv.
+//
+//  --hybrid also runs each variant with its leaves of error above each
+//  threshold replaced by PGM-indexes of epsilon --hybrid-epsilon (see
+//  rmi_hybrid.h), and writes their number, the size and the width of the
+//  last-mile windows to result/<dataset>_hybrid_results.csv. The tail latencies
+//  of every variant are in the percentile columns of the runtime results.
+//
+//  The time to load the parameters of each variant (see --load in page_alloc.h)
+//  and the latency of the first queries that follow are written to
+//  result/<dataset>_load_results.csv.
+//
+//  --threads also measures the throughput of every variant, and of a binary
+//  search on the whole dataset, on each number of threads (by default the
+//  powers of two up to the number of CPUs) pinned with the layout of
+//  throughput.h, each thread with its own stream of --throughput-nq random
+//  keys, and writes it to result/<dataset>_throughput_results.csv.
+//
+
+#include <sstream>
+#include "bench_rmi.h"
+#include "rmi_builder.h"
+#include "rmi_hybrid.h"
+#include "rmi_runtime.h"
+#include "throughput.h"
+
+
+/// The number of queries timed right after loading a variant.
+const size_t startup_queries = 1000;
+
+/// Returns the latency of the first query, and the average latency of the next ones, with the last-mile search.
+std::pair<size_t, size_t> first_queries(const rmi::RuntimeRMI& index, const mem::vector<uint64_t>& data,
+                                        const std::vector<uint64_t>& queries) {
+    size_t first = 0, next = 0, res = 0;
+    index.visit([&](const auto& model) {
+        auto search = [&](uint64_t q) {
+            auto r = model.lookup_range(q);
+            res += std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, q) - data.begin();
+        };
+        first = benchmark::timing([&] { search(queries[0]); });
+        next = benchmark::timing([&] {
+            for (size_t i = 1; i < queries.size(); ++i)
+                search(queries[i]);
+        }) / (queries.size() - 1);
+    });
+    std::cout << "Search result: " << res << std::endl;
+    return {first, next};
+}
+
+/// Returns the average and the maximum width of the last-mile range over all the keys.
+template<typename Index>
+std::pair<double, size_t> window_stats(const Index& index, const mem::vector<uint64_t>& data) {
+    size_t total = 0, width_max = 0;
+    index.visit([&](const auto& model) {
+        for (auto k : data) {
+            auto r = model.lookup_range(k);
+            total += r.hi - r.lo;
+            width_max = std::max(width_max, r.hi - r.lo);
+        }
+    });
+    return {double(total) / data.size(), width_max};
+}
+
+/// Returns the average and the maximum error over all the keys.
+std::pair<double, size_t> error_stats(const rmi::RuntimeRMI& index, const mem::vector<uint64_t>& data) {
+    size_t err_total = 0, err_max = 0;
+    index.visit([&](const auto& model) {
+        for (auto k : data) {
+            size_t err = 0;
+            model.lookup(k, &err);
+            err_total += err;
+            err_max = std::max(err_max, err);
+        }
+    });
+    return {double(err_total) / data.size(), err_max};
+}
+
+/// Parses a number of bytes, with an optional K, M or G suffix.
+size_t parse_bytes(const std::string& s) {
+    size_t end = 0;
+    auto bytes = std::stoull(s, &end);
+    switch (end < s.size() ? s[end] : ' ') {
+        case 'G': return bytes << 30;
+        case 'M': return bytes << 20;
+        case 'K': return bytes << 10;
+        default: return bytes;
+    }
+}
+
+/// Writes the throughput of lookup(q) on each number of threads to a line of the throughput results.
+template<typename Lookup>
+void bench_throughput(std::ofstream& ofs, const mem::vector<uint64_t>& data, const std::vector<size_t>& threads,
+                      throughput::Layout layout, size_t nq, const std::string& name, size_t size, Lookup&& lookup) {
+    auto streams = [&](size_t t) { return throughput::random_stream(data, nq, t + 1); };
+    for (auto t : threads) {
+        auto r = throughput::run(t, layout, streams, lookup);
+        std::cout << "Throughput (" << name << ") threads " << t << " " << r.mops() << " Mops/s" << std::endl;
+        ofs << name << "," << size << ",";
+        throughput::write(ofs, layout, r);
+        ofs << std::endl;
+    }
+}
+
+std::vector<std::string> parse_list(const std::string& s) {
+    std::vector<std::string> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(item);
+    return values;
+}
+
+
+int main(int argc, const char * argv[]) {
+    auto args = timer::parse_args(mem::parse_args(argc, argv));
+    size_t nq = 10000;
+    size_t repeat = 10;
+    const double alpha = 1.3;
+    std::vector<std::string> variants;
+    std::vector<std::string> leaves;
+    bool bounds = false;
+    std::vector<std::string> budgets;
+    std::vector<std::string> thresholds;
+    size_t hybrid_epsilon = 32;
+    std::vector<size_t> threads;
+    auto layout = throughput::Layout::cores;
+    size_t throughput_nq = 1 << 20;
+    std::string description_file;
+    for (auto& arg : args) {
+        if (arg.rfind("--nq=", 0) == 0) {
+            nq = std::stoull(arg.substr(5));
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            repeat = std::stoull(arg.substr(9));
+        } else if (arg.rfind("--variants=", 0) == 0) {
+            variants = parse_list(arg.substr(11));
+        } else if (arg.rfind("--leaves=", 0) == 0) {
+            leaves = parse_list(arg.substr(9));
+        } else if (arg == "--bounds") {
+            bounds = true;
+        } else if (arg.rfind("--merge=", 0) == 0) {
+            budgets = parse_list(arg.substr(8));
+        } else if (arg.rfind("--hybrid=", 0) == 0) {
+            thresholds = parse_list(arg.substr(9));
+        } else if (arg.rfind("--hybrid-epsilon=", 0) == 0) {
+            hybrid_epsilon = std::stoull(arg.substr(17));
+        } else if (arg == "--threads") {
+            threads = throughput::default_thread_counts();
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            for (auto& t : parse_list(arg.substr(10)))
+                threads.push_back(std::stoull(t));
+        } else if (arg.rfind("--layout=", 0) == 0) {
+            layout = throughput::parse_layout(arg.substr(9));
+        } else if (arg.rfind("--throughput-nq=", 0) == 0) {
+            throughput_nq = std::stoull(arg.substr(16));
+        } else {
+            description_file = arg;
+        }
+    }
+    if (description_file.empty()) {
+        std::cerr << "usage: " << argv[0] << " description_file [--variants=a,b] [--nq=N] [--repeat=N] [--leaves=compact12,compact8] [--bounds] [--merge=64M,32M] [--hybrid=256,1024] [--hybrid-epsilon=32] [--threads[=1,2,4]] [--layout=cores|smt|sockets] [--throughput-nq=N]" << std::endl;
+        return 1;
+    }
+
+    auto descriptions = rmi::load_descriptions(description_file);
+    const std::string fname = descriptions.dataset;
+
+    std::cout << "Load data from " << fname << " on " << mem::to_string(mem::policy().pages) << " pages" << std::endl;
+    auto data = benchmark::load_data<uint64_t, mem::Allocator<uint64_t>>(fname);
+    std::sort(data.begin(), data.end());
+
+    auto data_stats = benchmark::get_data_stats(data);
+    std::cout << "mean: " << data_stats.mean
+              << " variance: " << data_stats.var
+              << " hardness ratio: " << data_stats.var/(data_stats.mean*data_stats.mean) << std::endl;
+
+    std::string zipf_filename = "result/" + fname + "_runtime_zipfan_results.csv";
+    std::string rand_filename = "result/" + fname + "_runtime_random_results.csv";
+
+    auto startup = benchmark::gen_random_queries(data, startup_queries);
+    std::ofstream load_ofs("result/" + fname + "_load_results.csv");
+    load_ofs << "variant,load,pages,load_time,first_query_time,next_query_time" << std::endl;
+
+    std::ofstream leaves_ofs;
+    if (!leaves.empty()) {
+        leaves_ofs.open("result/" + fname + "_leaves_results.csv");
+        leaves_ofs << "variant,l1,size,avg_err,max_err" << std::endl;
+    }
+
+    std::ofstream merge_ofs;
+    if (!budgets.empty()) {
+        merge_ofs.open("result/" + fname + "_merge_results.csv");
+        merge_ofs << "variant,budget,size,leaves,avg_err,max_err,merge_time" << std::endl;
+    }
+
+    std::ofstream hybrid_ofs;
+    if (!thresholds.empty()) {
+        hybrid_ofs.open("result/" + fname + "_hybrid_results.csv");
+        hybrid_ofs << "variant,threshold,epsilon,fallbacks,size,avg_window,max_window" << std::endl;
+    }
+
+    std::ofstream throughput_ofs;
+    if (!threads.empty()) {
+        throughput_ofs.open("result/" + fname + "_throughput_results.csv");
+        throughput_ofs << "variant,size," << throughput::header() << std::endl;
+        bench_throughput(throughput_ofs, data, threads, layout, throughput_nq, "binary", 0,
+                         [&](uint64_t q) { return std::lower_bound(data.begin(), data.end(), q); });
+    }
+
+    auto bench = [&](const auto& index, const std::string& name) {
+        index.visit([&](const auto& model) {
+            auto run = [&](auto lookup) {
+                run_tests(data, nq, repeat, zipf_filename, [&](const mem::vector<uint64_t>& data, size_t nq) {
+                    return gen_zipfian_queries(data, nq, alpha);
+                }, lookup, index.size_in_bytes(), model, name);
+
+                run_tests(data, nq, repeat, rand_filename, [&](const mem::vector<uint64_t>& data, size_t nq) {
+                    return benchmark::gen_random_queries(data, nq);
+                }, lookup, index.size_in_bytes(), model, name);
+            };
+
+            if (!threads.empty()) {
+                bench_throughput(throughput_ofs, data, threads, layout, throughput_nq, name, index.size_in_bytes(),
+                                 [&](uint64_t q) {
+                                     auto r = model.lookup_range(q);
+                                     return std::lower_bound(data.begin() + r.lo, data.begin() + r.hi, q);
+                                 });
+            }
+
+            if constexpr (std::is_same_v<std::decay_t<decltype(index)>, rmi::RuntimeRMI>) {
+                if (!index.has_bounds()) {
+                    run([&](uint64_t key, size_t* err) { return model.lookup(key, err); });
+                    return;
+                }
+            }
+            run([&](uint64_t key) { return model.lookup_range(key); });
+        });
+    };
+
+    for (auto& d : descriptions.variants) {
+        if (!variants.empty() && std::find(variants.begin(), variants.end(), d.name) == variants.end())
+            continue;
+
+        std::cout << "RMI " << d.name << " l0 " << d.l0 << " l1 " << d.l1 << " branching " << d.branching << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        rmi::RuntimeRMI index(d, descriptions.parameters);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        auto [first_time, next_time] = first_queries(index, data, startup);
+        std::cout << "Load (" << mem::to_string(mem::policy().load) << ") time (ns) " << load_time
+                  << " first query " << first_time << " next queries " << next_time << std::endl;
+        load_ofs << d.name << "," << mem::to_string(mem::policy().load) << "," << mem::to_string(mem::policy().pages) << ","
+                 << load_time << "," << first_time << "," << next_time << std::endl;
+
+        bench(index, d.name);
+
+        if (bounds) {
+            rmi::RuntimeRMI bounded(d, descriptions.parameters);
+            bounded.set_bounds(rmi::fit_bounds(bounded, data.data(), data.size()));
+            std::cout << "Bounds: avg range " << window_stats(index, data).first << " -> " << window_stats(bounded, data).first << std::endl;
+            bench(bounded, d.name + "/bounds");
+        }
+
+        if (!thresholds.empty()) {
+            auto [avg_window, max_window] = window_stats(index, data);
+            hybrid_ofs << d.name << ",,," << 0 << "," << index.size_in_bytes() << "," << avg_window << "," << max_window << std::endl;
+        }
+        for (auto& threshold : thresholds) {
+            try {
+                rmi::RuntimeHybridRMI hybrid(index, data.data(), data.size(), std::stoull(threshold), hybrid_epsilon);
+                auto [avg_window, max_window] = window_stats(hybrid, data);
+                std::cout << "Hybrid " << threshold << " fallbacks " << hybrid.fallback_count()
+                          << " size " << index.size_in_bytes() << " -> " << hybrid.size_in_bytes()
+                          << " avg window " << avg_window << " max window " << max_window << std::endl;
+                hybrid_ofs << d.name << "," << threshold << "," << hybrid_epsilon << "," << hybrid.fallback_count() << ","
+                           << hybrid.size_in_bytes() << "," << avg_window << "," << max_window << std::endl;
+                bench(hybrid, d.name + "/hybrid" + threshold);
+            } catch (const std::exception& e) {
+                std::cout << "Hybrid " << threshold << ": " << e.what() << std::endl;
+            }
+        }
+
+        for (auto& budget : budgets) {
+            try {
+                auto start = std::chrono::high_resolution_clock::now();
+                auto merged = rmi::merge_leaves(index, data.data(), data.size(), parse_bytes(budget));
+                auto end = std::chrono::high_resolution_clock::now();
+                auto merge_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+                auto [avg_err, max_err] = error_stats(merged, data);
+                std::cout << "Merge " << budget << " size " << index.size_in_bytes() << " -> " << merged.size_in_bytes()
+                          << " leaves " << index.leaf_count() << " -> " << merged.leaf_count()
+                          << " avg error " << avg_err << " max error " << max_err << " time (ns) " << merge_time << std::endl;
+                merge_ofs << d.name << "," << parse_bytes(budget) << "," << merged.size_in_bytes() << "," << merged.leaf_count() << ","
+                          << avg_err << "," << max_err << "," << merge_time << std::endl;
+                bench(merged, d.name + "/merge" + budget);
+            } catch (const std::exception& e) {
+                std::cout << "Merge " << budget << ": " << e.what() << std::endl;
+            }
+        }
+
+        if (leaves.empty())
+            continue;
+
+        auto [avg_err, max_err] = error_stats(index, data);
+        leaves_ofs << d.name << "," << d.l1 << "," << index.size_in_bytes() << "," << avg_err << "," << max_err << std::endl;
+
+        for (auto& l1 : leaves) {
+            try {
+                auto compact = rmi::compact(index, data.data(), data.size(), l1);
+                auto [compact_avg_err, compact_max_err] = error_stats(compact, data);
+                std::cout << "Leaves " << l1 << " size " << index.size_in_bytes() << " -> " << compact.size_in_bytes()
+                          << " avg error " << avg_err << " -> " << compact_avg_err
+                          << " max error " << max_err << " -> " << compact_max_err << std::endl;
+                leaves_ofs << d.name << "," << l1 << "," << compact.size_in_bytes() << "," << compact_avg_err << "," << compact_max_err << std::endl;
+                bench(compact, d.name + "/" + l1);
+            } catch (const std::exception& e) {
+                std::cout << "Leaves " << l1 << ": " << e.what() << std::endl;
+            }
+        }
+    }
+    load_ofs.close();
+    leaves_ofs.close();
+    merge_ofs.close();
+    hybrid_ofs.close();
+    throughput_ofs.close();
+
+    return 0;
+}
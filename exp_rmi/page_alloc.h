@@ -0,0 +1,375 @@
+//
+//  page_alloc.h
+//  bench_search
+//
+//  Allocation of the large arrays (data, index segments, RMI parameters) on
+//  huge pages and on a given NUMA node.
+//
+//  Random lookups in a multi-GB array miss the TLB on almost every access when
+//  it is backed by 4 KB pages. The allocator below maps large arrays with the
+//  page size chosen by the benchmark (--pages=4k|thp|2m|1g) and binds them to a
+//  NUMA node (--numa-node=N). Small allocations and the default policy go
+//  through operator new as usual.
+//
+//  Parameter files (the RMI *_PARAMETERS) are loaded by load_file, which reads
+//  them into such an array, or maps them read-only (--load=mmap|populate|
+//  prefault) so that the first queries do not wait for the whole file, and so
+//  that several processes share the page cache instead of a private copy each.
+//
+
+#ifndef page_alloc_h
+#define page_alloc_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mem {
+
+enum class Pages {
+    standard,    ///< operator new, with whatever the system does by default
+    small,       ///< 4 KB pages, transparent huge pages disabled
+    transparent, ///< 2 MB transparent huge pages (madvise)
+    huge_2m,     ///< 2 MB pages from the hugetlbfs pool
+    huge_1g,     ///< 1 GB pages from the hugetlbfs pool
+};
+
+enum class Load {
+    read,     ///< read the whole file into memory allocated with the page policy
+    mmap,     ///< map the file read-only: the pages fault in during the first queries, while the kernel reads ahead
+    populate, ///< map the file read-only with MAP_POPULATE, which faults in all the pages before returning
+    prefault, ///< map the file read-only and touch all its pages with several threads before returning
+};
+
+/// The number of NUMA nodes the node mask passed to mbind can hold.
+constexpr int max_numa_nodes = 1024;
+
+struct Policy {
+    Pages pages = Pages::standard;
+    int numa_node = -1; ///< The node the memory is bound to, or -1 for the default policy of the system.
+    Load load = Load::read;
+    size_t prefault_threads = 0; ///< The threads touching the pages of Load::prefault, or 0 for all the cores.
+};
+
+/// The policy applied to the allocations made from now on.
+inline Policy &policy() {
+    static Policy p;
+    return p;
+}
+
+inline std::string to_string(Pages pages) {
+    switch (pages) {
+        case Pages::small: return "4k";
+        case Pages::transparent: return "thp";
+        case Pages::huge_2m: return "2m";
+        case Pages::huge_1g: return "1g";
+        default: return "default";
+    }
+}
+
+inline std::string to_string(Load load) {
+    switch (load) {
+        case Load::mmap: return "mmap";
+        case Load::populate: return "populate";
+        case Load::prefault: return "prefault";
+        default: return "read";
+    }
+}
+
+inline Load parse_load(const std::string &s) {
+    if (s == "mmap") return Load::mmap;
+    if (s == "populate") return Load::populate;
+    if (s == "prefault") return Load::prefault;
+    if (s != "read")
+        std::cerr << "unknown load mode " << s << ", reading the files" << std::endl;
+    return Load::read;
+}
+
+inline Pages parse_pages(const std::string &s) {
+    if (s == "4k") return Pages::small;
+    if (s == "thp") return Pages::transparent;
+    if (s == "2m") return Pages::huge_2m;
+    if (s == "1g") return Pages::huge_1g;
+    if (s != "default")
+        std::cerr << "unknown page size " << s << ", using the default" << std::endl;
+    return Pages::standard;
+}
+
+/// Parses a NUMA node, or returns -1 (the default policy) for a node outside [0, max_numa_nodes).
+inline int parse_numa_node(const std::string &s) {
+    auto node = std::stoi(s);
+    if (node < 0 || node >= max_numa_nodes) {
+        std::cerr << "NUMA node " << s << " out of range, using the default policy" << std::endl;
+        return -1;
+    }
+    return node;
+}
+
+/**
+ * Sets the policy from the options --pages=default|4k|thp|2m|1g, --numa-node=N, --load=read|mmap|populate|prefault
+ * and --prefault-threads=N, and returns the other arguments (without the program name).
+ */
+inline std::vector<std::string> parse_args(int argc, const char *argv[]) {
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--pages=", 0) == 0)
+            policy().pages = parse_pages(arg.substr(8));
+        else if (arg.rfind("--numa-node=", 0) == 0)
+            policy().numa_node = parse_numa_node(arg.substr(12));
+        else if (arg.rfind("--load=", 0) == 0)
+            policy().load = parse_load(arg.substr(7));
+        else if (arg.rfind("--prefault-threads=", 0) == 0)
+            policy().prefault_threads = std::stoull(arg.substr(19));
+        else
+            args.push_back(arg);
+    }
+    return args;
+}
+
+/// Allocations smaller than this go through operator new whatever the policy.
+constexpr size_t min_mapped_bytes = size_t(1) << 20;
+
+namespace internal {
+
+/// The length of the mappings made by allocate() and load_file(), to unmap them.
+struct Mappings {
+    std::mutex mutex;
+    std::unordered_map<void *, size_t> lengths;
+
+    static Mappings &get() {
+        static Mappings m;
+        return m;
+    }
+};
+
+#if defined(__linux__)
+inline void warn_once(const std::string &msg) {
+    static bool warned = false;
+    if (!warned)
+        std::cerr << msg << std::endl;
+    warned = true;
+}
+
+/// Maps length bytes aligned to alignment, by over-mapping and trimming the excess.
+inline void *map_aligned(size_t length, size_t alignment) {
+    auto p = mmap(nullptr, length + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return nullptr;
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    auto aligned = (addr + alignment - 1) / alignment * alignment;
+    if (aligned > addr)
+        munmap(p, aligned - addr);
+    if (addr + alignment > aligned)
+        munmap(reinterpret_cast<void *>(aligned + length), addr + alignment - aligned);
+    return reinterpret_cast<void *>(aligned);
+}
+
+inline void *map(size_t bytes, const Policy &policy, size_t &length) {
+    constexpr size_t page_4k = size_t(1) << 12, page_2m = size_t(1) << 21, page_1g = size_t(1) << 30;
+    auto pages = policy.pages;
+    void *p = nullptr;
+
+    if (pages == Pages::huge_1g || pages == Pages::huge_2m) {
+        auto page = pages == Pages::huge_1g ? page_1g : page_2m;
+        auto shift = pages == Pages::huge_1g ? 30 : 21;
+        length = (bytes + page - 1) / page * page;
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+        if (p == MAP_FAILED) {
+            warn_once("no " + to_string(pages) + " pages in the hugetlbfs pool, using transparent huge pages");
+            p = nullptr;
+            pages = Pages::transparent;
+        }
+    }
+
+    if (pages == Pages::transparent) {
+        length = (bytes + page_2m - 1) / page_2m * page_2m;
+        p = map_aligned(length, page_2m);
+        if (p && madvise(p, length, MADV_HUGEPAGE) != 0)
+            warn_once("transparent huge pages are not available");
+    } else if (pages == Pages::small || pages == Pages::standard) {
+        length = (bytes + page_4k - 1) / page_4k * page_4k;
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        if (pages == Pages::small)
+            madvise(p, length, MADV_NOHUGEPAGE);
+    }
+
+    if (p && policy.numa_node >= 0) {
+        // mbind(MPOL_BIND) before the pages are touched, so that they are allocated on the node
+        constexpr int mpol_bind = 2;
+        unsigned long mask[max_numa_nodes / 64] = {};
+        mask[policy.numa_node / 64] = 1ul << (policy.numa_node % 64);
+        if (syscall(SYS_mbind, p, length, mpol_bind, mask, sizeof(mask) * 8, 0) != 0)
+            warn_once("cannot bind memory to NUMA node " + std::to_string(policy.numa_node));
+    }
+    return p;
+}
+
+/// Reads one byte of every page of [addr, addr + bytes), split among the given number of threads.
+inline void prefault(const void *addr, size_t bytes, size_t threads) {
+    constexpr size_t page = size_t(1) << 12;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    auto pages = (bytes + page - 1) / page;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([=] {
+            auto p = static_cast<const volatile char *>(addr);
+            for (auto i = pages * t / threads; i < pages * (t + 1) / threads; ++i)
+                (void) p[i * page];
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+}
+
+/// Maps the first bytes of a file read-only according to the load policy, or returns nullptr.
+inline void *map_file(const std::string &path, size_t bytes, const Policy &policy) {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= bytes && bytes > 0)
+        p = mmap(nullptr, bytes, PROT_READ, MAP_SHARED | (policy.load == Load::populate ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+    if (policy.load == Load::mmap)
+        madvise(p, bytes, MADV_WILLNEED);
+    else if (policy.load == Load::prefault)
+        prefault(p, bytes, policy.prefault_threads);
+    return p;
+}
+#endif
+
+}
+
+/**
+ * Allocates @p bytes according to the current @ref policy. The memory must be released with @ref deallocate.
+ * @return the allocated memory, or nullptr if the allocation failed
+ */
+inline void *allocate(size_t bytes) {
+#if defined(__linux__)
+    auto &p = policy();
+    if (bytes >= min_mapped_bytes && (p.pages != Pages::standard || p.numa_node >= 0)) {
+        size_t length;
+        auto addr = internal::map(bytes, p, length);
+        if (addr) {
+            auto &m = internal::Mappings::get();
+            std::lock_guard<std::mutex> lock(m.mutex);
+            m.lengths[addr] = length;
+            return addr;
+        }
+    }
+#endif
+    return ::operator new(bytes, std::nothrow);
+}
+
+/**
+ * Releases memory returned by @ref allocate.
+ */
+inline void deallocate(void *addr) {
+    if (!addr)
+        return;
+#if defined(__linux__)
+    {
+        auto &m = internal::Mappings::get();
+        std::lock_guard<std::mutex> lock(m.mutex);
+        auto it = m.lengths.find(addr);
+        if (it != m.lengths.end()) {
+            munmap(addr, it->second);
+            m.lengths.erase(it);
+            return;
+        }
+    }
+#endif
+    ::operator delete(addr);
+}
+
+/**
+ * Loads the first @p bytes of the file @p path according to the load mode of the current @ref policy: read into memory
+ * from @ref allocate, or mapped read-only. Either way, the memory must be released with @ref deallocate, and must not
+ * be written to.
+ * @return the loaded bytes, or nullptr if the file cannot be opened or is shorter than @p bytes
+ */
+inline void *load_file(const std::string &path, size_t bytes) {
+#if defined(__linux__)
+    auto &p = policy();
+    if (p.load != Load::read) {
+        auto addr = internal::map_file(path, bytes, p);
+        if (addr) {
+            auto &m = internal::Mappings::get();
+            std::lock_guard<std::mutex> lock(m.mutex);
+            m.lengths[addr] = bytes;
+        }
+        return addr;
+    }
+#endif
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.good())
+        return nullptr;
+    auto addr = allocate(bytes);
+    if (!addr)
+        return nullptr;
+    in.read(static_cast<char *>(addr), bytes);
+    if (!in.good()) {
+        deallocate(addr);
+        return nullptr;
+    }
+    return addr;
+}
+
+/**
+ * A standard allocator that places the large arrays according to the current @ref policy.
+ */
+template<typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+
+    template<typename U>
+    Allocator(const Allocator<U> &) {}
+
+    T *allocate(size_t n) {
+        auto p = mem::allocate(n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t) { mem::deallocate(p); }
+
+    template<typename U>
+    bool operator==(const Allocator<U> &) const { return true; }
+
+    template<typename U>
+    bool operator!=(const Allocator<U> &) const { return false; }
+};
+
+template<typename T>
+using vector = std::vector<T, Allocator<T>>;
+
+}
+
+#endif /* page_alloc_h */
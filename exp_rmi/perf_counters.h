@@ -0,0 +1,235 @@
+//
+//  perf_counters.h
+//  bench_search
+//
+//  Hardware performance counters of the lookups, read with perf_event_open.
+//
+//  The latency of a lookup says how long it took, not why: the counters below
+//  tell the cache and TLB misses, the branch misses and the instructions that
+//  went into it. The benchmarks count them over a query loop, separately for
+//  the model inference (the position and the range of every key) and for the
+//  last-mile search of the ranges, and report them per lookup.
+//
+//  The events are opened once per thread, in user space only, each on its own
+//  so that an event the CPU (or the hypervisor) lacks does not take the others
+//  down, and their counts are scaled by the time they were scheduled when the
+//  PMU multiplexes them. An event that cannot be opened, for instance with
+//  /proc/sys/kernel/perf_event_paranoid above 2 or off Linux, is reported as
+//  missing (NaN, an empty column in the results).
+//
+
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "timer.h"
+
+namespace perf {
+
+enum Event {
+    cycles,
+    instructions,
+    branch_misses,
+    l1d_misses,  ///< L1 data cache read misses
+    llc_misses,  ///< last-level cache read misses
+    dtlb_misses, ///< data TLB read misses
+    event_count
+};
+
+inline std::string to_string(Event e) {
+    switch (e) {
+        case cycles: return "cycles";
+        case instructions: return "instructions";
+        case branch_misses: return "branch_misses";
+        case l1d_misses: return "l1d_misses";
+        case llc_misses: return "llc_misses";
+        case dtlb_misses: return "dtlb_misses";
+        default: return "unknown";
+    }
+}
+
+/// The counts of the events over a measurement, or NaN for the events that could not be counted.
+struct Sample {
+    std::array<double, event_count> values;
+
+    Sample() { values.fill(std::numeric_limits<double>::quiet_NaN()); }
+
+    double operator[](Event e) const { return values[e]; }
+
+    Sample operator/(double d) const {
+        Sample s;
+        for (size_t i = 0; i < event_count; ++i)
+            s.values[i] = values[i] / d;
+        return s;
+    }
+};
+
+/// Writes a count, or nothing for a missing one, in a CSV column.
+inline std::ostream &operator<<(std::ostream &os, const Sample &s) {
+    for (size_t i = 0; i < event_count; ++i) {
+        if (i > 0)
+            os << ",";
+        if (!std::isnan(s.values[i]))
+            os << s.values[i];
+    }
+    return os;
+}
+
+/// Describes the counts, e.g. "cycles 120.5 instructions 80 ...", skipping the missing ones.
+inline std::string describe(const Sample &s) {
+    std::string d;
+    for (size_t i = 0; i < event_count; ++i) {
+        if (std::isnan(s.values[i]))
+            continue;
+        auto v = std::to_string(s.values[i]);
+        d += (d.empty() ? "" : " ") + to_string(Event(i)) + " " + v.substr(0, v.find('.') + 3);
+    }
+    return d;
+}
+
+/// Returns the CSV header of a Sample: the names of the events, each between @p prefix and @p suffix.
+inline std::string header(const std::string &prefix, const std::string &suffix = "") {
+    std::string h;
+    for (size_t i = 0; i < event_count; ++i)
+        h += (i > 0 ? "," : "") + prefix + to_string(Event(i)) + suffix;
+    return h;
+}
+
+/**
+ * The counters of the events on the calling thread. Use @ref counters() rather than one object per measurement, since
+ * opening the events costs several system calls.
+ */
+class Counters {
+    std::array<int, event_count> fds;
+
+#if defined(__linux__)
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static constexpr uint64_t cache_miss(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+public:
+    Counters() {
+        fds.fill(-1);
+#if defined(__linux__)
+        fds[cycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[instructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[branch_misses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        fds[l1d_misses] = open(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+        fds[llc_misses] = open(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+        fds[dtlb_misses] = open(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+#endif
+        if (!available())
+            std::cerr << "no hardware performance counters (see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+    }
+
+    Counters(const Counters &) = delete;
+    Counters &operator=(const Counters &) = delete;
+
+    ~Counters() {
+#if defined(__linux__)
+        for (auto fd : fds)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    /// Whether any of the events is counted.
+    bool available() const {
+        for (auto fd : fds)
+            if (fd >= 0)
+                return true;
+        return false;
+    }
+
+    /// Returns the counts of the events during fn().
+    template<typename F>
+    Sample measure(F &&fn) {
+        Sample s;
+#if defined(__linux__)
+        for (auto fd : fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        fn();
+        for (auto fd : fds)
+            if (fd >= 0)
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        for (size_t i = 0; i < event_count; ++i) {
+            uint64_t v[3]; // value, time enabled, time running
+            if (fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+                continue;
+            s.values[i] = v[2] < v[1] ? double(v[0]) * v[1] / v[2] : double(v[0]);
+        }
+#else
+        fn();
+#endif
+        return s;
+    }
+};
+
+/// The counters of the calling thread, opened at the first call.
+inline Counters &counters() {
+    thread_local Counters c;
+    return c;
+}
+
+/// The counts per lookup of the two phases of a lookup.
+struct Phases {
+    Sample inference; ///< Finding the approximate position and the range of the key.
+    Sample last_mile; ///< Searching the range.
+};
+
+/**
+ * Counts the events of the lookups of the queries, per lookup. @p infer(q) returns the range of q, which is stored, and
+ * @p finish(q, range) searches it; the two phases run in separate loops over the queries.
+ */
+template<typename Queries, typename Infer, typename Finish>
+Phases measure_phases(const Queries &queries, Infer &&infer, Finish &&finish) {
+    using Range = decltype(infer(queries[0]));
+    std::vector<Range> ranges(queries.size());
+    auto &c = counters();
+    Phases p;
+    p.inference = c.measure([&] {
+        for (size_t i = 0; i < queries.size(); ++i)
+            ranges[i] = infer(queries[i]);
+    }) / double(queries.size());
+    p.last_mile = c.measure([&] {
+        for (size_t i = 0; i < queries.size(); ++i)
+            timer::do_not_optimize(finish(queries[i], ranges[i]));
+    }) / double(queries.size());
+    return p;
+}
+
+}
+
+#endif /* perf_counters_h */
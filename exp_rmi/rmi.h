@@ -0,0 +1,458 @@
+//
+//  rmi.h
+//  bench_search
+//
+//  Two-level RMI models over the parameters of the generated RMI code.
+//
+//  The generated lookup() functions evaluate the root (L0) model and the leaf (L1)
+//  model in one go. The classes below compute exactly the same prediction, but
+//  expose the two stages separately so that a lookup can be interleaved with
+//  others between the root and the leaf fetch. A three-level RMI is a
+//  TwoLevelRMI whose root also includes the middle layer (LayeredRoot).
+//
+//  The batched lookups evaluate the root and the leaves of several keys per
+//  instruction with AVX-512 or AVX2 (see namespace simd), when compiled with
+//  -march=native; otherwise, one key at a time.
+//
+
+#ifndef rmi_h
+#define rmi_h
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include "coro.h"
+
+#if (defined(__AVX512F__) && defined(__AVX512DQ__)) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+namespace rmi {
+
+inline double linear(double alpha, double beta, double inp) {
+    return std::fma(beta, inp, alpha);
+}
+
+inline double cubic(double a, double b, double c, double d, double x) {
+    auto v1 = std::fma(a, x, b);
+    auto v2 = std::fma(v1, x, c);
+    auto v3 = std::fma(v2, x, d);
+    return v3;
+}
+
+inline size_t FCLAMP(double inp, double bound) {
+    if (inp < 0.0) return 0;
+    return (inp > bound ? bound : (size_t)inp);
+}
+
+/// Root models: map a key to the index of the leaf responsible for it. fraction() returns the part of the output of
+/// the model that the index truncates, the position of the key within its leaf used by the compact leaves.
+
+struct LinearRoot {
+    double alpha;
+    double beta;
+    double branching;
+
+    size_t operator()(uint64_t key) const { return FCLAMP(linear(alpha, beta, (double)key), branching - 1.0); }
+    double fraction(uint64_t key, size_t index) const { return linear(alpha, beta, (double)key) - (double)index; }
+};
+
+struct CubicRoot {
+    double a, b, c, d;
+
+    size_t operator()(uint64_t key) const { return (uint64_t) cubic(a, b, c, d, (double)key); }
+    double fraction(uint64_t key, size_t index) const { return cubic(a, b, c, d, (double)key) - (double)index; }
+};
+
+struct RadixRoot {
+    uint64_t prefix_length;
+    uint64_t bits;
+
+    size_t operator()(uint64_t key) const { return (key << prefix_length) >> (64 - bits); }
+    double fraction(uint64_t key, size_t) const { return (double)((key << prefix_length) << bits) * 0x1p-64; }
+};
+
+struct RadixTableRoot {
+    const uint32_t* table;
+    uint64_t prefix_length;
+    uint64_t shift;
+
+    size_t operator()(uint64_t key) const { return table[((key << prefix_length) >> prefix_length) >> shift]; }
+    /// The table maps ranges of keys to leaves in any order: there is no position within the leaf.
+    double fraction(uint64_t, size_t) const { return 0.0; }
+};
+
+/**
+ * A root whose output goes through a table, which maps each of its count leaves to the merged leaf that replaced it
+ * (see rmi::merge_leaves). Merged leaves are absolute: there is no position within the leaf.
+ */
+template<typename Root>
+struct MappedRoot {
+    Root root;
+    const uint32_t* map;
+    size_t count;
+
+    size_t operator()(uint64_t key) const { return map[std::min<size_t>(root(key), count - 1)]; }
+    double fraction(uint64_t, size_t) const { return 0.0; }
+};
+
+/// Inner models: records of the middle layer of a three-level RMI, which map a key to a leaf. They have no error.
+
+struct LinearInner {
+    static constexpr size_t bytes = 16;
+
+    static double predict(const char* p, uint64_t key) {
+        return linear(*((double*) (p + 0)), *((double*) (p + 8)), (double)key);
+    }
+};
+
+/**
+ * The first two levels of a three-level RMI, used as the root of a TwoLevelRMI: the root model picks one of the
+ * inner_count models of the middle layer, which maps the key to one of the leaves.
+ */
+template<typename Root, typename Inner>
+struct LayeredRoot {
+    Root root;
+    const char* inner;
+    size_t inner_count;
+    double branching;
+
+    double predict(uint64_t key) const {
+        return Inner::predict(inner + std::min<size_t>(root(key), inner_count - 1) * Inner::bytes, key);
+    }
+
+    size_t operator()(uint64_t key) const { return FCLAMP(predict(key), branching - 1.0); }
+    double fraction(uint64_t key, size_t index) const { return predict(key) - (double)index; }
+};
+
+/// Leaf models: records of the L1_PARAMETERS array, followed by the error bound of the leaf.
+
+struct LinearLeaf {
+    static constexpr size_t bytes = 24;
+    static constexpr bool relative = false;
+
+    static double predict(const char* p, uint64_t key) {
+        return linear(*((double*) (p + 0)), *((double*) (p + 8)), (double)key);
+    }
+    static uint64_t error(const char* p) { return *((uint64_t*) (p + 16)); }
+};
+
+struct CubicLeaf {
+    static constexpr size_t bytes = 40;
+    static constexpr bool relative = false;
+
+    static double predict(const char* p, uint64_t key) {
+        return cubic(*((double*) (p + 0)), *((double*) (p + 8)), *((double*) (p + 16)), *((double*) (p + 24)), (double)key);
+    }
+    static uint64_t error(const char* p) { return *((uint64_t*) (p + 32)); }
+};
+
+/// Compact leaves: a linear model of the fraction of the root output past the index of the leaf, instead of the key.
+/// The fraction is in [0, 1) for the keys that the root maps to their leaf without clamping, so that a slope of few
+/// bits is accurate; it falls outside for the keys clamped to the first or last leaf by LinearRoot and LayeredRoot,
+/// and for CubicRoot, whose output is not clamped. The fraction itself is never clamped: TwoLevelRMI::predict clamps
+/// the prediction to [0, n - 1], and rmi::compact (rmi_builder.h), which encodes the leaves from the data, measures
+/// the error of each leaf on all of its keys, so the bound holds for the keys outside [0, 1) too. The intercept is a
+/// signed whole position, the prediction at the start of the leaf.
+
+/// 12 bytes: int32 intercept, float slope (positions per leaf), uint32 error.
+struct CompactLeaf12 {
+    static constexpr size_t bytes = 12;
+    static constexpr bool relative = true;
+    static constexpr double max_slope = 3.4e38;
+    static constexpr uint64_t max_error = UINT32_MAX;
+
+    static double predict(const char* p, double fraction) {
+        return std::fma((double) *((float*) (p + 4)), fraction, (double) *((int32_t*) (p + 0)));
+    }
+    static uint64_t error(const char* p) { return *((uint32_t*) (p + 8)); }
+
+    static void encode(char* p, int32_t base, double slope) {
+        auto s = (float) slope;
+        std::memcpy(p, &base, 4);
+        std::memcpy(p + 4, &s, 4);
+    }
+    static void encode_error(char* p, uint64_t err) {
+        auto e = (uint32_t) err;
+        std::memcpy(p + 8, &e, 4);
+    }
+};
+
+/// 8 bytes: int32 intercept, uint16 fixed-point slope (whole positions per leaf), uint16 error.
+struct CompactLeaf8 {
+    static constexpr size_t bytes = 8;
+    static constexpr bool relative = true;
+    static constexpr double max_slope = UINT16_MAX;
+    static constexpr uint64_t max_error = UINT16_MAX;
+
+    static double predict(const char* p, double fraction) {
+        return std::fma((double) *((uint16_t*) (p + 4)), fraction, (double) *((int32_t*) (p + 0)));
+    }
+    static uint64_t error(const char* p) { return *((uint16_t*) (p + 6)); }
+
+    static void encode(char* p, int32_t base, double slope) {
+        auto s = (uint16_t) std::lround(slope);
+        std::memcpy(p, &base, 4);
+        std::memcpy(p + 4, &s, 2);
+    }
+    static void encode_error(char* p, uint64_t err) {
+        auto e = (uint16_t) err;
+        std::memcpy(p + 6, &e, 2);
+    }
+};
+
+/// The positions [lo, hi) searched by the last mile for a key, and the predicted position pos.
+struct Range {
+    size_t pos;
+    size_t lo;
+    size_t hi;
+
+    /// The window [pred - err, pred + err) of a symmetric error, clamped to [0, n).
+    static Range around(size_t pred, size_t err, size_t n) {
+        return {pred, pred > err ? pred - err : 0, std::min(pred + err, n)};
+    }
+};
+
+/// The error bounds of a leaf on each side of its predictions: the position of every key of the leaf is in
+/// [pred - below, pred + above]. They are computed from the data by rmi::fit_bounds (rmi_builder.h).
+struct LeafBounds {
+    uint32_t below;
+    uint32_t above;
+};
+
+/**
+ * Vector versions of the models, which evaluate simd::lanes keys at once: 8 with AVX-512 (F and DQ), 4 with AVX2 and
+ * FMA. They compute exactly the same results as the scalar models, for leaf indices and positions below 2^52.
+ */
+namespace simd {
+
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+#define RMI_SIMD
+constexpr size_t lanes = 8;
+using vd = __m512d;
+using vi = __m512i;
+
+inline vi load(const uint64_t* p) { return _mm512_loadu_si512(p); }
+inline void store(uint64_t* p, vi v) { _mm512_storeu_si512(p, v); }
+inline vd set1(double x) { return _mm512_set1_pd(x); }
+inline vd fma(vd a, vd b, vd c) { return _mm512_fmadd_pd(a, b, c); }
+inline vd to_double(vi x) { return _mm512_cvtepu64_pd(x); }
+inline vi truncate(vd x) { return _mm512_cvttpd_epu64(x); }
+inline vd clamp(vd x, double bound) { return _mm512_min_pd(_mm512_max_pd(x, _mm512_setzero_pd()), set1(bound)); }
+inline vi times3(vi i) { return _mm512_add_epi64(i, _mm512_slli_epi64(i, 1)); }
+inline vd gather(const double* base, vi i) { return _mm512_i64gather_pd(i, base, 8); }
+inline vi gather(const uint64_t* base, vi i) { return _mm512_i64gather_epi64(i, base, 8); }
+inline vi shift(vi x, uint64_t left, uint64_t right) {
+    return _mm512_srl_epi64(_mm512_sll_epi64(x, _mm_cvtsi64_si128(left)), _mm_cvtsi64_si128(right));
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+#define RMI_SIMD
+constexpr size_t lanes = 4;
+using vd = __m256d;
+using vi = __m256i;
+
+inline vi load(const uint64_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+inline void store(uint64_t* p, vi v) { _mm256_storeu_si256((__m256i*) p, v); }
+inline vd set1(double x) { return _mm256_set1_pd(x); }
+inline vd fma(vd a, vd b, vd c) { return _mm256_fmadd_pd(a, b, c); }
+/// The high and the low 32 bits are converted exactly, and rounded once by their sum, as the scalar conversion.
+inline vd to_double(vi x) {
+    auto hi = _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_castpd_si256(set1(0x1p84)));
+    auto lo = _mm256_blend_epi32(x, _mm256_castpd_si256(set1(0x1p52)), 0xaa);
+    return _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(hi), set1(0x1p84 + 0x1p52)), _mm256_castsi256_pd(lo));
+}
+/// For 0 <= x < 2^52: the whole part of x is in the low bits of the mantissa of x + 2^52.
+inline vi truncate(vd x) {
+    auto t = _mm256_add_pd(_mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), set1(0x1p52));
+    return _mm256_xor_si256(_mm256_castpd_si256(t), _mm256_castpd_si256(set1(0x1p52)));
+}
+inline vd clamp(vd x, double bound) { return _mm256_min_pd(_mm256_max_pd(x, _mm256_setzero_pd()), set1(bound)); }
+inline vi times3(vi i) { return _mm256_add_epi64(i, _mm256_slli_epi64(i, 1)); }
+inline vd gather(const double* base, vi i) { return _mm256_i64gather_pd(base, i, 8); }
+inline vi gather(const uint64_t* base, vi i) { return _mm256_i64gather_epi64((const long long*) base, i, 8); }
+inline vi shift(vi x, uint64_t left, uint64_t right) {
+    return _mm256_srl_epi64(_mm256_sll_epi64(x, _mm_cvtsi64_si128(left)), _mm_cvtsi64_si128(right));
+}
+#else
+constexpr size_t lanes = 1;
+#endif
+
+#if defined(RMI_SIMD)
+/// The leaf indices of lanes keys, as the root models.
+inline vi root(const LinearRoot& r, vi keys) {
+    return truncate(clamp(fma(set1(r.beta), to_double(keys), set1(r.alpha)), r.branching - 1.0));
+}
+inline vi root(const CubicRoot& r, vi keys) {
+    auto x = to_double(keys);
+    return truncate(clamp(fma(fma(fma(set1(r.a), x, set1(r.b)), x, set1(r.c)), x, set1(r.d)), 0x1p52 - 1));
+}
+inline vi root(const RadixRoot& r, vi keys) { return shift(keys, r.prefix_length, 64 - r.bits); }
+#endif
+
+/// Whether the root model of type Root has a vector version.
+template<typename Root>
+constexpr bool vector_root = std::is_same_v<Root, LinearRoot> || std::is_same_v<Root, CubicRoot>
+                             || std::is_same_v<Root, RadixRoot>;
+
+}
+
+/**
+ * A two-level RMI with a root model of type Root and leaves of type Leaf.
+ * It does not own the parameters: they stay in the arrays allocated by the generated load().
+ * When bounds is not null, it has the asymmetric bounds of each leaf, used by lookup_range instead of the error.
+ */
+template<typename Root, typename Leaf>
+class TwoLevelRMI {
+    Root root;
+    const char* leaves;
+    double n;
+    const LeafBounds* bounds;
+
+public:
+    TwoLevelRMI(Root root, const char* leaves, size_t n, const LeafBounds* bounds = nullptr)
+        : root(root), leaves(leaves), n(n), bounds(bounds) {}
+
+    const Root& root_model() const { return root; }
+
+    size_t leaf_index(uint64_t key) const { return root(key); }
+
+    const char* leaf(size_t i) const { return leaves + i * Leaf::bytes; }
+
+    uint64_t error(const char* leaf) const { return Leaf::error(leaf); }
+
+    uint64_t predict(const char* leaf, uint64_t key, size_t* err) const {
+        *err = Leaf::error(leaf);
+        if constexpr (Leaf::relative) {
+            auto fraction = root.fraction(key, (leaf - leaves) / Leaf::bytes);
+            return FCLAMP(Leaf::predict(leaf, fraction), n - 1.0);
+        } else {
+            return FCLAMP(Leaf::predict(leaf, key), n - 1.0);
+        }
+    }
+
+    uint64_t lookup(uint64_t key, size_t* err) const {
+        return predict(leaf(leaf_index(key)), key, err);
+    }
+
+    /// Returns the range of the last-mile search of the prediction pred, of error err, of the leaf i.
+    Range window(size_t i, uint64_t pred, size_t err) const {
+        if (bounds == nullptr)
+            return Range::around(pred, err, n);
+        auto& b = bounds[i];
+        return {pred, pred > b.below ? pred - b.below : 0, std::min(pred + b.above + 1, size_t(n))};
+    }
+
+    /// Returns the range of the last-mile search of a key in a leaf.
+    Range range(const char* leaf, uint64_t key) const {
+        size_t err;
+        auto pred = predict(leaf, key, &err);
+        return window((leaf - leaves) / Leaf::bytes, pred, err);
+    }
+
+    /// The maximum number of keys of a group of @ref search_batch.
+    static constexpr size_t max_batch_group = 64;
+
+    /// Writes the leaf index of each of the count keys to idx, simd::lanes keys at a time for a vector root.
+    void leaf_indices(const uint64_t* keys, size_t count, size_t* idx) const {
+        size_t i = 0;
+#if defined(RMI_SIMD)
+        if constexpr (simd::vector_root<Root>) {
+            for (; i + simd::lanes <= count; i += simd::lanes)
+                simd::store(idx + i, simd::root(root, simd::load(keys + i)));
+        }
+#endif
+        for (; i < count; ++i)
+            idx[i] = leaf_index(keys[i]);
+    }
+
+    /**
+     * Writes the prediction and the error of each of the count keys in its leaf idx[i] to pos and err, as predict().
+     * The parameters of linear leaves are gathered and evaluated simd::lanes keys at a time.
+     */
+    void predict_batch(const uint64_t* keys, const size_t* idx, size_t count, uint64_t* pos, size_t* err) const {
+        size_t i = 0;
+#if defined(RMI_SIMD)
+        if constexpr (std::is_same_v<Leaf, LinearLeaf>) {
+            auto params = reinterpret_cast<const double*>(leaves);
+            auto errors = reinterpret_cast<const uint64_t*>(leaves) + 2;
+            for (; i + simd::lanes <= count; i += simd::lanes) {
+                auto j = simd::times3(simd::load(idx + i));
+                auto pred = simd::fma(simd::gather(params + 1, j), simd::to_double(simd::load(keys + i)), simd::gather(params, j));
+                simd::store(pos + i, simd::truncate(simd::clamp(pred, n - 1.0)));
+                simd::store(err + i, simd::gather(errors, j));
+            }
+        }
+#endif
+        for (; i < count; ++i)
+            pos[i] = predict(leaf(idx[i]), keys[i], &err[i]);
+    }
+
+    /// Batched version of @ref lookup: writes the prediction and the error of each of the count keys to pos and err.
+    void lookup_batch(const uint64_t* keys, size_t count, uint64_t* pos, size_t* err) const {
+        size_t idx[max_batch_group];
+        for (size_t i = 0; i < count; i += max_batch_group) {
+            auto g = std::min(max_batch_group, count - i);
+            leaf_indices(keys + i, g, idx);
+            predict_batch(keys + i, idx, g, pos + i, err + i);
+        }
+    }
+
+    /**
+     * Batched lookups followed by the last-mile search of the benchmark harness: writes the position of the first
+     * element >= keys[i] to out[i]. The keys are processed in groups of @p group keys; the leaves of a group are
+     * prefetched before any of them is read, and the middle of the last-mile ranges before any of them is searched.
+     */
+    void search_batch(const uint64_t* data, size_t size, const uint64_t* keys, size_t count, size_t* out,
+                      size_t group = 16) const {
+        size_t idx[max_batch_group], lo[max_batch_group], hi[max_batch_group];
+        uint64_t pos[max_batch_group];
+        size_t err[max_batch_group];
+        group = std::clamp<size_t>(group, 1, max_batch_group);
+        for (size_t i = 0; i < count; i += group) {
+            auto g = std::min(group, count - i);
+            leaf_indices(keys + i, g, idx);
+            for (size_t j = 0; j < g; ++j)
+                __builtin_prefetch(leaf(idx[j]));
+            predict_batch(keys + i, idx, g, pos, err);
+            for (size_t j = 0; j < g; ++j) {
+                auto r = window(idx[j], pos[j], err[j]);
+                lo[j] = std::min(r.lo, size);
+                hi[j] = std::min(r.hi, size);
+                __builtin_prefetch(data + (lo[j] + hi[j]) / 2);
+            }
+            for (size_t j = 0; j < g; ++j)
+                out[i + j] = std::lower_bound(data + lo[j], data + hi[j], keys[i + j]) - data;
+        }
+    }
+
+    /// Returns the range of positions [lo, hi) that contains the first occurrence of the key, if it is in the data.
+    Range lookup_range(uint64_t key) const {
+        return range(leaf(leaf_index(key)), key);
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /**
+     * Coroutine version of a lookup followed by the last-mile search of the benchmark harness,
+     * to be run by coro::interleave. It suspends after the root model, before fetching the leaf,
+     * and before the last-mile search. Returns the position of the first element >= key.
+     */
+    coro::Task<size_t> search_coro(const uint64_t* data, size_t size, uint64_t key) const {
+        auto l = leaf(leaf_index(key));
+        co_await coro::prefetch(l);
+        auto r = range(l, key);
+        co_await coro::prefetch(data + (r.lo + r.hi) / 2);
+        co_return std::lower_bound(data + std::min(r.lo, size), data + std::min(r.hi, size), key) - data;
+    }
+#endif
+};
+
+/// A three-level RMI: a TwoLevelRMI whose root is made of the root model and the middle layer.
+template<typename Root, typename Inner, typename Leaf>
+using ThreeLevelRMI = TwoLevelRMI<LayeredRoot<Root, Inner>, Leaf>;
+
+}
+
+#endif /* rmi_h */
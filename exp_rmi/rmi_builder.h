@@ -0,0 +1,557 @@
+//
+//  rmi_builder.h
+//  bench_search
+//
+//  Builds two- and three-level RMIs in process, instead of generating code with
+//  the external RMI tool, so that a model can be retrained when the data changes.
+//
+//  The root (L0) is a linear, cubic or radix model that maps a key to one of
+//  the leaves; each leaf (L1) is a linear regression over the keys the root
+//  maps to it, stored with the maximum error of its predictions. The leaves
+//  have the layout of the *_L1_PARAMETERS files, so the result is a RuntimeRMI
+//  and runs the same lookup code as the shipped models. The leaves and their
+//  errors are computed in parallel with OpenMP. A three-level RMI has a middle
+//  layer of linear models between the root and the leaves (build_three_level).
+//
+//  After training, merge_leaves replaces runs of adjacent leaves by single
+//  linear leaves to fit the model in a memory budget.
+//
+
+#ifndef rmi_builder_h
+#define rmi_builder_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "rmi.h"
+#include "rmi_runtime.h"
+#include "page_alloc.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_num_procs() 1
+#define omp_get_max_threads() 1
+#endif
+
+namespace rmi {
+
+namespace internal {
+
+inline std::string to_string(double x) {
+    std::ostringstream ss;
+    ss.precision(17);
+    ss << x;
+    return ss.str();
+}
+
+/// Returns the parameters of the linear regression y = alpha + beta * x of the given points, with x centered for
+/// precision. The sums are computed by the given number of threads.
+template<typename Fx, typename Fy>
+std::pair<double, double> linear_regression(size_t first, size_t last, Fx x, Fy y, [[maybe_unused]] int threads = 1) {
+    auto n = double(last - first);
+    double sum_x = 0, sum_y = 0;
+    #pragma omp parallel for reduction(+:sum_x, sum_y) num_threads(threads) if(threads > 1)
+    for (auto i = first; i < last; ++i) {
+        sum_x += x(i);
+        sum_y += y(i);
+    }
+    auto mean_x = sum_x / n, mean_y = sum_y / n;
+    double cov = 0, var = 0;
+    #pragma omp parallel for reduction(+:cov, var) num_threads(threads) if(threads > 1)
+    for (auto i = first; i < last; ++i) {
+        auto dx = x(i) - mean_x;
+        cov += dx * (y(i) - mean_y);
+        var += dx * dx;
+    }
+    if (n < 2 || var == 0)
+        return {mean_y, 0.0};
+    auto beta = cov / var;
+    return {mean_y - beta * mean_x, beta};
+}
+
+/**
+ * Returns the coefficients (a, b, c, d) of the cubic a x^3 + b x^2 + c x + d that maps the keys to [0, branching - 1]
+ * through a monotone Hermite spline. The spline goes from the first to the last key, with the end slopes fitted by
+ * least squares on a sample and clipped so that the spline is monotone (Fritsch-Carlson).
+ */
+inline std::vector<double> fit_cubic_root(const uint64_t* keys, size_t n, size_t branching) {
+    auto x0 = double(keys[0]);
+    auto s = std::max(1.0, double(keys[n - 1]) - x0);
+
+    // In normalized space t, u in [0, 1]: h(t) = m0 * h0(t) + m1 * h1(t) + h2(t)
+    double a00 = 0, a01 = 0, a11 = 0, b0 = 0, b1 = 0;
+    auto step = std::max<size_t>(1, n / 100000);
+    for (size_t i = 0; i < n; i += step) {
+        auto t = (double(keys[i]) - x0) / s;
+        auto u = double(i) / double(n - 1 ? n - 1 : 1);
+        auto h0 = t * t * t - 2 * t * t + t;
+        auto h1 = t * t * t - t * t;
+        auto r = u - (-2 * t * t * t + 3 * t * t);
+        a00 += h0 * h0;
+        a01 += h0 * h1;
+        a11 += h1 * h1;
+        b0 += h0 * r;
+        b1 += h1 * r;
+    }
+    auto det = a00 * a11 - a01 * a01;
+    double m0 = 1, m1 = 1;
+    if (det != 0) {
+        m0 = (b0 * a11 - b1 * a01) / det;
+        m1 = (a00 * b1 - a01 * b0) / det;
+    }
+    m0 = std::max(0.0, m0);
+    m1 = std::max(0.0, m1);
+    auto norm = std::sqrt(m0 * m0 + m1 * m1);
+    if (norm > 3) {
+        m0 *= 3 / norm;
+        m1 *= 3 / norm;
+    }
+
+    // h(t) = c3 t^3 + c2 t^2 + c1 t, scaled by branching - 1 and expanded in x = x0 + s t
+    auto scale = double(branching - 1);
+    auto c3 = scale * (m0 + m1 - 2) / (s * s * s);
+    auto c2 = scale * (3 - 2 * m0 - m1) / (s * s);
+    auto c1 = scale * m0 / s;
+    return {c3,
+            c2 - 3 * c3 * x0,
+            c1 - 2 * c2 * x0 + 3 * c3 * x0 * x0,
+            -c1 * x0 + c2 * x0 * x0 - c3 * x0 * x0 * x0};
+}
+
+/**
+ * Returns the first key of each leaf of the model, followed by n. Throws std::runtime_error if the root does not map
+ * the keys monotonically to the leaves, or maps some outside [0, branching).
+ */
+template<typename Model>
+std::vector<size_t> leaf_begins(const Model& model, const uint64_t* keys, size_t n, size_t branching, int parallelism) {
+    std::vector<size_t> begin(branching + 1, n);
+    size_t bad = 0;
+    auto chunk_size = (n + parallelism - 1) / parallelism;
+    #pragma omp parallel for reduction(+:bad) num_threads(parallelism)
+    for (int t = 0; t < parallelism; ++t) {
+        auto first = std::min(n, t * chunk_size);
+        auto last = std::min(n, first + chunk_size);
+        size_t prev = first == 0 ? 0 : model.leaf_index(keys[first - 1]);
+        for (auto i = first; i < last; ++i) {
+            auto j = model.leaf_index(keys[i]);
+            if (j >= branching || (i > 0 && j < prev)) {
+                ++bad;
+                continue;
+            }
+            if (i == 0)
+                std::fill(begin.begin(), begin.begin() + j + 1, 0);
+            else
+                std::fill(begin.begin() + prev + 1, begin.begin() + j + 1, i);
+            prev = j;
+        }
+    }
+    if (bad)
+        throw std::runtime_error("the root maps " + std::to_string(bad) + " keys out of order or out of range");
+    return begin;
+}
+
+/// Sets v to max(v, x) atomically.
+inline void atomic_max(uint32_t& v, uint32_t x) {
+    auto cur = __atomic_load_n(&v, __ATOMIC_RELAXED);
+    while (cur < x && !__atomic_compare_exchange_n(&v, &cur, x, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/// Returns the position of the i-th key: that of its first occurrence, the result of the last-mile search. The first
+/// occurrence is in the same leaf, which starts at first.
+inline size_t position(const uint64_t* keys, size_t first, size_t i) {
+    if (i == first || keys[i] != keys[i - 1])
+        return i;
+    return std::lower_bound(keys + first, keys + i, keys[i]) - keys;
+}
+
+/**
+ * The lines through a first point (x0, y0) that pass within err of every point added so far: their slopes are in
+ * [lo, hi]. Used to merge leaves greedily in linear time, as the segments of a PGM-index.
+ */
+struct Cone {
+    double err;
+    bool anchored = false;
+    uint64_t x0 = 0;
+    double y0 = 0;
+    double lo = 0;
+    double hi = std::numeric_limits<double>::infinity();
+
+    /// Narrows the cone to the point (x, y), x >= x0. Returns false, and leaves the cone unusable, if it is empty.
+    bool add(uint64_t x, double y) {
+        if (!anchored) {
+            anchored = true;
+            x0 = x;
+            y0 = y;
+            return true;
+        }
+        if (x == x0)
+            return std::abs(y - y0) <= err;
+        auto dx = double(x - x0);
+        lo = std::max(lo, (y - err - y0) / dx);
+        hi = std::min(hi, (y + err - y0) / dx);
+        return lo <= hi;
+    }
+
+    /// The line in the middle of the cone, as the (alpha, beta) of a linear leaf.
+    std::pair<double, double> line() const {
+        auto slope = std::isinf(hi) ? lo : (lo + hi) / 2;
+        return {y0 - slope * double(x0), slope};
+    }
+};
+
+/**
+ * Returns the first leaf of each run of adjacent leaves that one line predicts within err, followed by the number of
+ * leaves. The runs are extended greedily, in parallel over chunks of the leaves; a leaf that no line predicts within
+ * err is a run of its own. begin has the first key of each leaf, as returned by leaf_begins.
+ */
+inline std::vector<size_t> merge_runs(const std::vector<size_t>& begin, const uint64_t* keys, double err,
+                                      int parallelism) {
+    auto leaves = begin.size() - 1;
+    auto chunk_size = (leaves + parallelism - 1) / parallelism;
+    std::vector<std::vector<size_t>> starts(parallelism);
+    #pragma omp parallel for num_threads(parallelism)
+    for (int t = 0; t < parallelism; ++t) {
+        auto first = std::min(leaves, t * chunk_size);
+        auto last = std::min(leaves, first + chunk_size);
+        Cone cone{err};
+        size_t run = first;
+        for (auto j = first; j < last; ++j) {
+            auto fits = [&](Cone& c) {
+                for (auto i = begin[j]; i < begin[j + 1]; ++i)
+                    if (!c.add(keys[i], double(position(keys, begin[run], i))))
+                        return false;
+                return true;
+            };
+            if (fits(cone) || j == run)
+                continue;
+            starts[t].push_back(run);
+            run = j;
+            cone = Cone{err};
+            fits(cone);
+        }
+        if (last > first)
+            starts[t].push_back(run);
+    }
+    std::vector<size_t> runs;
+    for (auto& s : starts)
+        runs.insert(runs.end(), s.begin(), s.end());
+    runs.push_back(leaves);
+    return runs;
+}
+
+/// Returns the parameters of the root model l0 with the given branching factor, fitted on the keys.
+inline std::vector<std::string> fit_root(const uint64_t* keys, size_t n, const std::string& l0, size_t branching,
+                                         int parallelism) {
+    if (l0 == "linear") {
+        auto [alpha, beta] = linear_regression(0, n, [&](size_t i) { return double(keys[i]); },
+                                               [&](size_t i) { return double(i) * branching / n; }, parallelism);
+        return {to_string(alpha), to_string(beta)};
+    } else if (l0 == "cubic") {
+        std::vector<std::string> params;
+        for (auto c : fit_cubic_root(keys, n, branching))
+            params.push_back(to_string(c));
+        return params;
+    } else if (l0 == "radix") {
+        if ((branching & (branching - 1)) != 0)
+            throw std::invalid_argument("the branching factor of a radix root must be a power of two");
+        auto diff = keys[0] ^ keys[n - 1];
+        auto prefix_length = diff ? __builtin_clzll(diff) : 63;
+        auto bits = __builtin_ctzll(branching);
+        if (prefix_length + bits > 64)
+            prefix_length = 64 - bits;
+        return {std::to_string(prefix_length), std::to_string(bits)};
+    }
+    throw std::invalid_argument("unsupported root model " + l0);
+}
+
+/// Returns the linear leaves of the model, each fitted on the keys it maps to and followed by its error.
+template<typename Model>
+mem::vector<char> fit_leaves(const Model& model, const uint64_t* keys, size_t n, size_t branching, int parallelism) {
+    auto begin = leaf_begins(model, keys, n, branching, parallelism);
+    mem::vector<char> params(branching * LinearLeaf::bytes);
+    #pragma omp parallel for schedule(dynamic, 1024) num_threads(parallelism)
+    for (size_t j = 0; j < branching; ++j) {
+        auto first = begin[j], last = begin[j + 1];
+        auto record = params.data() + j * LinearLeaf::bytes;
+        auto pos = [&](size_t i) { return double(position(keys, first, i)); };
+        double coeffs[2] = {double(first), 0.0};
+        if (last > first) {
+            auto [alpha, beta] = linear_regression(first, last, [&](size_t i) { return double(keys[i]); }, pos);
+            coeffs[0] = alpha;
+            coeffs[1] = beta;
+        }
+        std::memcpy(record, coeffs, sizeof(coeffs));
+
+        // The error: the last-mile search of [pred - err, pred + err) must contain the position of every key
+        uint64_t err = 0;
+        for (auto i = first; i < last; ++i) {
+            auto pred = FCLAMP(LinearLeaf::predict(record, keys[i]), n - 1.0);
+            auto p = position(keys, first, i);
+            err = std::max<uint64_t>(err, (pred > p ? pred - p : p - pred) + 1);
+        }
+        std::memcpy(record + 16, &err, sizeof(err));
+    }
+    return params;
+}
+
+}
+
+/**
+ * Builds a two-level RMI on the n sorted keys.
+ * @param l0 the root model: linear, cubic or radix
+ * @param branching the number of leaves, a power of two for radix
+ * @param threads the number of threads fitting the leaves, or 0 for the OpenMP default
+ * @param name the name of the variant in the description of the result
+ * Throws std::invalid_argument for an unsupported root, and std::runtime_error if the root does not map the keys
+ * monotonically to the leaves (which can happen to a cubic root on keys far from 0, due to rounding).
+ */
+inline RuntimeRMI build(const uint64_t* keys, size_t n, const std::string& l0, size_t branching, int threads = 0,
+                        const std::string& name = "built") {
+    if (n == 0 || branching == 0)
+        throw std::invalid_argument("the RMI needs at least one key and one leaf");
+    auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+
+    Description desc;
+    desc.name = name;
+    desc.l0 = l0;
+    desc.l1 = "linear";
+    desc.branching = branching;
+    desc.size = n;
+    desc.l0_parameters = internal::fit_root(keys, n, l0, branching, parallelism);
+
+    RuntimeRMI empty(desc, mem::vector<char>(branching * LinearLeaf::bytes));
+    return empty.visit([&](const auto& model) {
+        return RuntimeRMI(desc, internal::fit_leaves(model, keys, n, branching, parallelism));
+    });
+}
+
+/**
+ * Builds a three-level RMI on the n sorted keys: the root picks one of the mid_branching linear models of the middle
+ * layer, which picks one of the leaves. Each model of the middle layer is the line through the first and the last of
+ * the keys the root maps to it, at their scaled positions, so that the keys are mapped to the leaves monotonically.
+ * @param l0 the root model: linear, cubic or radix
+ * @param mid_branching the number of models of the middle layer, a power of two for radix
+ * @param branching the number of leaves
+ * The other parameters and the exceptions are those of @ref build.
+ */
+inline RuntimeRMI build_three_level(const uint64_t* keys, size_t n, const std::string& l0, size_t mid_branching,
+                                    size_t branching, int threads = 0, const std::string& name = "built") {
+    if (n == 0 || mid_branching == 0 || branching == 0)
+        throw std::invalid_argument("the RMI needs at least one key and one model per level");
+    auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+
+    Description desc;
+    desc.name = name;
+    desc.l0 = l0;
+    desc.l1 = "linear";
+    desc.branching = mid_branching;
+    desc.size = n;
+    desc.l0_parameters = internal::fit_root(keys, n, l0, mid_branching, parallelism);
+
+    // The middle layer, fitted on the keys the root maps to each of its models
+    RuntimeRMI root(desc, mem::vector<char>(mid_branching * LinearLeaf::bytes));
+    auto mid = root.visit([&](const auto& model) {
+        auto begin = internal::leaf_begins(model, keys, n, mid_branching, parallelism);
+        mem::vector<char> params(mid_branching * LinearInner::bytes);
+        auto scale = double(branching) / n;
+        #pragma omp parallel for schedule(dynamic, 1024) num_threads(parallelism)
+        for (size_t j = 0; j < mid_branching; ++j) {
+            auto first = begin[j], last = begin[j + 1];
+            double coeffs[2] = {double(first) * scale, 0.0};
+            if (last > first + 1 && keys[last - 1] > keys[first]) {
+                auto y0 = double(first) * scale;
+                auto y1 = double(internal::position(keys, first, last - 1)) * scale;
+                coeffs[1] = (y1 - y0) / (double(keys[last - 1]) - double(keys[first]));
+                coeffs[0] = y0 - coeffs[1] * double(keys[first]);
+            }
+            std::memcpy(params.data() + j * LinearInner::bytes, coeffs, sizeof(coeffs));
+        }
+        return params;
+    });
+
+    desc.mid = "linear";
+    desc.mid_branching = mid_branching;
+    desc.branching = branching;
+    auto mid_copy = mid;
+    RuntimeRMI empty(desc, mem::vector<char>(branching * LinearLeaf::bytes), {}, std::move(mid));
+    return empty.visit([&](const auto& model) {
+        return RuntimeRMI(desc, internal::fit_leaves(model, keys, n, branching, parallelism), {}, std::move(mid_copy));
+    });
+}
+
+/**
+ * Computes the asymmetric bounds of the leaves of an RMI (rmi.h) on its n sorted keys: the largest distance of the
+ * position of a key below and above the prediction of its leaf. They replace the symmetric error of the leaves in
+ * RuntimeRMI::set_bounds, and narrow the last-mile search when the errors of a leaf are skewed to one side.
+ * @param threads the number of threads, or 0 for the OpenMP default
+ * Throws std::invalid_argument if the positions do not fit in 32 bits.
+ */
+inline mem::vector<LeafBounds> fit_bounds(const RuntimeRMI& index, const uint64_t* keys, size_t n, int threads = 0) {
+    if (n > UINT32_MAX)
+        throw std::invalid_argument("leaf bounds store positions on 32 bits");
+    [[maybe_unused]] auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+    mem::vector<LeafBounds> bounds(index.leaf_count(), LeafBounds{0, 0});
+
+    index.visit([&](const auto& model) {
+        // The keys of a leaf are contiguous, except under a radix_table root, hence the atomic updates
+        #pragma omp parallel for schedule(static, 1 << 16) num_threads(parallelism)
+        for (size_t i = 0; i < n; ++i) {
+            auto j = model.leaf_index(keys[i]);
+            if (j >= bounds.size())
+                continue;
+            size_t err;
+            auto pred = model.predict(model.leaf(j), keys[i], &err);
+            auto pos = internal::position(keys, 0, i);
+            if (pos < pred)
+                internal::atomic_max(bounds[j].below, pred - pos);
+            else if (pos > pred)
+                internal::atomic_max(bounds[j].above, pos - pred);
+        }
+    });
+    return bounds;
+}
+
+/**
+ * Re-encodes the leaves of an RMI as compact leaves (rmi.h): each leaf is refitted by linear regression on the
+ * fraction of the root output of its keys, quantized, and its error recomputed on the keys.
+ * @param encoding compact12 or compact8
+ * @param threads the number of threads encoding the leaves, or 0 for the OpenMP default
+ * Throws std::invalid_argument for a radix_table root, whose output has no fraction, or an unknown encoding, and
+ * std::runtime_error if a leaf does not fit the encoding.
+ */
+inline RuntimeRMI compact(const RuntimeRMI& index, const uint64_t* keys, size_t n, const std::string& encoding,
+                          int threads = 0) {
+    auto& desc = index.description();
+    if (desc.l0 == "radix_table" || desc.merged)
+        throw std::invalid_argument("the leaves of a radix_table root or merged leaves cannot be compacted");
+    if (encoding != "compact12" && encoding != "compact8")
+        throw std::invalid_argument("unknown leaf encoding " + encoding);
+    if (n > INT32_MAX)
+        throw std::invalid_argument("compact leaves store positions on 31 bits");
+    auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+
+    return index.visit([&](const auto& model) -> RuntimeRMI {
+        auto begin = internal::leaf_begins(model, keys, n, desc.branching, parallelism);
+        auto encode = [&](auto leaf) {
+            using Leaf = decltype(leaf);
+            mem::vector<char> params(desc.branching * Leaf::bytes);
+            size_t overflows = 0;
+            #pragma omp parallel for schedule(dynamic, 1024) reduction(+:overflows) num_threads(parallelism)
+            for (size_t j = 0; j < desc.branching; ++j) {
+                auto first = begin[j], last = begin[j + 1];
+                auto record = params.data() + j * Leaf::bytes;
+                auto fraction = [&](size_t i) { return model.root_model().fraction(keys[i], j); };
+                double base = double(first), slope = 0;
+                if (last > first) {
+                    auto [alpha, beta] = internal::linear_regression(first, last, fraction,
+                                                                     [&](size_t i) { return double(internal::position(keys, first, i)); });
+                    base = alpha;
+                    slope = beta;
+                }
+                slope = std::clamp(slope, 0.0, Leaf::max_slope);
+                Leaf::encode(record, int32_t(std::clamp<double>(std::round(base), INT32_MIN, INT32_MAX)), slope);
+
+                uint64_t err = 0;
+                for (auto i = first; i < last; ++i) {
+                    auto pred = FCLAMP(Leaf::predict(record, fraction(i)), n - 1.0);
+                    auto pos = internal::position(keys, first, i);
+                    err = std::max<uint64_t>(err, (pred > pos ? pred - pos : pos - pred) + 1);
+                }
+                overflows += err > Leaf::max_error;
+                Leaf::encode_error(record, std::min(err, Leaf::max_error));
+            }
+            if (overflows)
+                throw std::runtime_error(std::to_string(overflows) + " leaves have an error too large for " + encoding);
+            return index.with_leaves(encoding, std::move(params));
+        };
+        if (encoding == "compact12")
+            return encode(CompactLeaf12());
+        return encode(CompactLeaf8());
+    });
+}
+
+/**
+ * Merges runs of adjacent leaves of an RMI into single linear leaves, so that its size_in_bytes() is at most budget,
+ * and remaps the output of the root to the merged leaves through a table of 32-bit indices (MappedRoot in rmi.h). The
+ * runs are those of the smallest error, found by bisection, whose model fits in the budget: one line predicts all the
+ * keys of a run within this error. A run of one linear leaf keeps its model, and the error of every merged leaf is
+ * recomputed on its keys. The result has no bounds.
+ * @param threads the number of threads, or 0 for the OpenMP default
+ * Throws std::invalid_argument for a radix_table root, compact or already merged leaves, or a budget too small for the
+ * root, the table and one leaf per thread.
+ */
+inline RuntimeRMI merge_leaves(const RuntimeRMI& index, const uint64_t* keys, size_t n, size_t budget,
+                               int threads = 0) {
+    auto& desc = index.description();
+    if (desc.l0 == "radix_table" || desc.merged || (desc.l1 != "linear" && desc.l1 != "cubic"))
+        throw std::invalid_argument("only the linear or cubic leaves of a monotone root can be merged");
+    auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+
+    // The size of the merged model, but for the leaves
+    auto leaf_bytes = index.leaf_count() * (index.leaf_bytes() + (index.has_bounds() ? sizeof(LeafBounds) : 0));
+    auto fixed = index.size_in_bytes() - leaf_bytes + desc.branching * sizeof(uint32_t);
+    auto max_leaves = budget > fixed ? (budget - fixed) / LinearLeaf::bytes : 0;
+
+    return index.visit([&](const auto& model) -> RuntimeRMI {
+        auto begin = internal::leaf_begins(model, keys, n, desc.branching, parallelism);
+
+        size_t lo = 0, hi = n;
+        if (internal::merge_runs(begin, keys, hi, parallelism).size() - 1 > max_leaves)
+            throw std::invalid_argument("a budget of " + std::to_string(budget) + " bytes is too small to merge "
+                                        + desc.name);
+        while (lo < hi) {
+            auto mid = (lo + hi) / 2;
+            if (internal::merge_runs(begin, keys, mid, parallelism).size() - 1 <= max_leaves)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        auto runs = internal::merge_runs(begin, keys, lo, parallelism);
+
+        auto count = runs.size() - 1;
+        mem::vector<char> params(count * LinearLeaf::bytes);
+        mem::vector<uint32_t> map(desc.branching);
+        #pragma omp parallel for schedule(dynamic, 1024) num_threads(parallelism)
+        for (size_t r = 0; r < count; ++r) {
+            auto a = runs[r], b = runs[r + 1];
+            std::fill(map.begin() + a, map.begin() + b, uint32_t(r));
+            auto first = begin[a], last = begin[b];
+            auto record = params.data() + r * LinearLeaf::bytes;
+            if (b == a + 1 && desc.l1 == "linear") {
+                std::memcpy(record, model.leaf(a), LinearLeaf::bytes);
+                continue;
+            }
+
+            auto pos = [&](size_t i) { return double(internal::position(keys, first, i)); };
+            internal::Cone cone{double(lo)};
+            bool fits = true;
+            for (auto i = first; i < last && fits; ++i)
+                fits = cone.add(keys[i], pos(i));
+            auto [alpha, beta] = fits ? cone.line()
+                                      : internal::linear_regression(first, last, [&](size_t i) { return double(keys[i]); }, pos);
+            double coeffs[2] = {last > first ? alpha : double(first), last > first ? beta : 0.0};
+            std::memcpy(record, coeffs, sizeof(coeffs));
+
+            uint64_t err = 0;
+            for (auto i = first; i < last; ++i) {
+                auto pred = FCLAMP(LinearLeaf::predict(record, keys[i]), n - 1.0);
+                auto p = internal::position(keys, first, i);
+                err = std::max<uint64_t>(err, (pred > p ? pred - p : p - pred) + 1);
+            }
+            std::memcpy(record + 16, &err, sizeof(err));
+        }
+        return index.with_leaves("linear", std::move(params), std::move(map));
+    });
+}
+
+}
+
+#endif /* rmi_builder_h */
@@ -0,0 +1,163 @@
+//
+//  rmi_hybrid.h
+//  bench_search
+//
+//  RMIs whose leaves with a large error are replaced by PGM-indexes.
+//
+//  On hard datasets a few leaves have errors far above the others, and their
+//  last-mile searches dominate the tail latency. RuntimeHybridRMI replaces every
+//  leaf whose error exceeds a threshold by a pgm::RuntimePGMIndex on the keys of
+//  the leaf, so that no last-mile search is wider than the threshold or the
+//  window of the PGM-index (2 epsilon + 2). The leaf itself is the tag: the
+//  error of a replaced leaf is HybridRMI::fallback_tag, and its first 8 bytes
+//  are the index of its PGM-index, so that the other leaves are looked up with
+//  the same loads as before.
+//
+//  It needs the PGM-index headers of ../exp_pgm on the include path.
+//
+
+#ifndef rmi_hybrid_h
+#define rmi_hybrid_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "pgm_index_runtime.h"
+#include "rmi.h"
+#include "rmi_builder.h"
+#include "rmi_runtime.h"
+
+namespace rmi {
+
+/// The PGM-index that replaces a leaf, on the keys of the leaf, which start at position offset.
+struct Fallback {
+    size_t offset;
+    pgm::RuntimePGMIndex<uint64_t> pgm;
+};
+
+/**
+ * The lookups of an RMI Model (a TwoLevelRMI) whose tagged leaves are replaced by PGM-indexes, dispatched on the tag
+ * of the leaf of each key.
+ */
+template<typename Model>
+class HybridRMI {
+    Model model;
+    const Fallback* fallbacks;
+
+public:
+    static constexpr uint64_t fallback_tag = std::numeric_limits<uint64_t>::max();
+
+    HybridRMI(const Model& model, const Fallback* fallbacks) : model(model), fallbacks(fallbacks) {}
+
+    /// Returns the range of the last-mile search of a key in a leaf, or in the PGM-index that replaces it.
+    Range range(const char* leaf, uint64_t key) const {
+        if (model.error(leaf) != fallback_tag)
+            return model.range(leaf, key);
+        uint64_t i;
+        std::memcpy(&i, leaf, sizeof(i));
+        auto& f = fallbacks[i];
+        auto p = f.pgm.search(key);
+        return {f.offset + p.pos, f.offset + p.lo, f.offset + p.hi};
+    }
+
+    /// Returns the range of positions [lo, hi) that contains the first occurrence of the key, if it is in the data.
+    Range lookup_range(uint64_t key) const {
+        return range(model.leaf(model.leaf_index(key)), key);
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /// Same as TwoLevelRMI::search_coro. The PGM-index of a replaced leaf is searched without suspending.
+    coro::Task<size_t> search_coro(const uint64_t* data, size_t size, uint64_t key) const {
+        auto l = model.leaf(model.leaf_index(key));
+        co_await coro::prefetch(l);
+        auto r = range(l, key);
+        co_await coro::prefetch(data + (r.lo + r.hi) / 2);
+        co_return std::lower_bound(data + std::min(r.lo, size), data + std::min(r.hi, size), key) - data;
+    }
+#endif
+};
+
+/**
+ * An RMI whose leaves with an error above a threshold are replaced by PGM-indexes. It owns a tagged copy of the leaves
+ * and the PGM-indexes; the lookups run on the HybridRMI passed by @ref visit.
+ */
+class RuntimeHybridRMI {
+    RuntimeRMI index;
+    std::vector<Fallback> fallbacks;
+
+public:
+    /**
+     * Replaces the leaves of @p rmi whose error is above @p threshold by PGM-indexes with the given epsilon, built on
+     * the n sorted keys of the RMI. The bounds of the RMI, if any, are dropped.
+     * @param threads the number of threads building the PGM-indexes, or 0 for the OpenMP default
+     * Throws std::invalid_argument if the leaves are not linear or cubic, whose error field holds the tag, or for a
+     * radix_table root, whose leaves are not ranges of keys.
+     */
+    RuntimeHybridRMI(const RuntimeRMI& rmi, const uint64_t* keys, size_t n, size_t threshold, size_t epsilon,
+                     int threads = 0)
+        : index(rmi) {
+        auto& desc = rmi.description();
+        if ((desc.l1 != "linear" && desc.l1 != "cubic") || desc.l0 == "radix_table")
+            throw std::invalid_argument("only the linear or cubic leaves of a monotone root can be replaced");
+        auto parallelism = threads > 0 ? threads : std::min(omp_get_num_procs(), omp_get_max_threads());
+
+        auto leaves = rmi.visit([&](const auto& model) {
+            auto count = rmi.leaf_count();
+            auto bytes = rmi.leaf_bytes();
+            auto begin = internal::leaf_begins(model, keys, n, count, parallelism);
+            mem::vector<char> tagged(model.leaf(0), model.leaf(0) + count * bytes);
+            std::vector<size_t> ends;
+            for (size_t j = 0; j < count; ++j) {
+                if (model.error(model.leaf(j)) <= threshold || begin[j + 1] == begin[j])
+                    continue;
+                uint64_t i = fallbacks.size();
+                auto tag = HybridRMI<std::decay_t<decltype(model)>>::fallback_tag;
+                std::memcpy(tagged.data() + j * bytes, &i, sizeof(i));
+                std::memcpy(tagged.data() + (j + 1) * bytes - sizeof(tag), &tag, sizeof(tag));
+                fallbacks.push_back({begin[j], {}});
+                ends.push_back(begin[j + 1]);
+            }
+
+            #pragma omp parallel for schedule(dynamic, 1) num_threads(parallelism)
+            for (size_t i = 0; i < fallbacks.size(); ++i) {
+                auto first = fallbacks[i].offset;
+                fallbacks[i].pgm = pgm::RuntimePGMIndex<uint64_t>(keys + first, keys + ends[i], epsilon, 4);
+            }
+            return tagged;
+        });
+        index = rmi.with_leaves(desc.l1, std::move(leaves));
+    }
+
+    const RuntimeRMI& rmi() const { return index; }
+
+    /// The number of leaves replaced by a PGM-index.
+    size_t fallback_count() const { return fallbacks.size(); }
+
+    /// Returns the size of the RMI and of the PGM-indexes in bytes.
+    size_t size_in_bytes() const {
+        auto bytes = index.size_in_bytes();
+        for (auto& f : fallbacks)
+            bytes += sizeof(f.offset) + f.pgm.size_in_bytes();
+        return bytes;
+    }
+
+    /**
+     * Calls @p f with the HybridRMI of the models of this variant, and returns its result. It refers to the parameters
+     * of this object, so it must not outlive it.
+     */
+    template<typename F>
+    decltype(auto) visit(F&& f) const {
+        return index.visit([&](const auto& model) {
+            return f(HybridRMI<std::decay_t<decltype(model)>>(model, fallbacks.data()));
+        });
+    }
+};
+
+}
+
+#endif /* rmi_hybrid_h */
@@ -0,0 +1,361 @@
+//
+//  rmi_runtime.h
+//  bench_search
+//
+//  A two- or three-level RMI configured at runtime from a model description, so
+//  that one binary can benchmark every generated variant against a single loaded
+//  dataset.
+//
+//  A description file (RMI_*_code/*.rmi) lists the variants of a dataset:
+//
+//      dataset = fb_200M_uint64
+//      parameters = RMI_output_fb
+//
+//      [fb_200M_uint64_0]
+//      l0 = linear             # linear | cubic | radix | radix_table
+//      l1 = linear             # linear | cubic | compact12 | compact8
+//      branching = 16777216    # the number of leaves
+//      size = 200000000        # the number of keys
+//      l0_parameters = 2593.0904023256153 0.0002166426405130368
+//
+//  The root parameters are (alpha, beta) for linear, (a, b, c, d) for cubic,
+//  (prefix_length, bits) for radix and (prefix_length, shift) for radix_table.
+//
+//  A three-level RMI (see rmi_builder.h) also has a middle layer between the
+//  root, which then picks one of its models, and the leaves:
+//
+//      mid = linear            # the model of the middle layer
+//      mid_branching = 65536   # the number of models of the middle layer
+//
+//  Its models are loaded from <parameters>/<name>_LM_PARAMETERS.
+//
+//  The leaves of a merged RMI (see rmi::merge_leaves) replace runs of the
+//  leaves of the root, through a table of `branching` 32-bit indices loaded
+//  from <parameters>/<name>_MAP_PARAMETERS:
+//
+//      merged = 1048576        # the number of leaves after merging
+//
+//  The leaves are loaded from <parameters>/<name>_L1_PARAMETERS and the table of
+//  radix_table from <parameters>/<name>_L0_PARAMETERS, the files of the
+//  generated load(), with mem::load_file: read into memory, or mapped read-only
+//  with --load=mmap|populate|prefault.
+//
+
+#ifndef rmi_runtime_h
+#define rmi_runtime_h
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "rmi.h"
+#include "page_alloc.h"
+
+namespace rmi {
+
+/// The model of a variant, as read from a description file.
+struct Description {
+    std::string name;
+    std::string l0;
+    std::string l1;
+    std::string mid;            ///< The model of the middle layer of a three-level RMI, or empty.
+    size_t mid_branching = 0;   ///< The number of models of the middle layer.
+    size_t merged = 0;          ///< The number of leaves after merging, or 0.
+    size_t branching = 0;
+    size_t size = 0;
+    std::vector<std::string> l0_parameters;
+};
+
+/// The variants of a dataset, as read from a description file.
+struct Descriptions {
+    std::string dataset;
+    std::string parameters; ///< The directory of the parameter files.
+    std::vector<Description> variants;
+};
+
+inline std::string trim(const std::string& s) {
+    auto first = s.find_first_not_of(" \t\r");
+    auto last = s.find_last_not_of(" \t\r");
+    return first == std::string::npos ? "" : s.substr(first, last - first + 1);
+}
+
+/**
+ * Reads a description file. Throws std::runtime_error if it cannot be read or is malformed.
+ */
+inline Descriptions load_descriptions(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in.good())
+        throw std::runtime_error("unable to open " + filename);
+
+    Descriptions d;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        if (line.front() == '[' && line.back() == ']') {
+            d.variants.emplace_back();
+            d.variants.back().name = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error(filename + ": expected key = value, got " + line);
+        auto key = trim(line.substr(0, eq));
+        auto value = trim(line.substr(eq + 1));
+        if (d.variants.empty()) {
+            if (key == "dataset") d.dataset = value;
+            else if (key == "parameters") d.parameters = value;
+            else throw std::runtime_error(filename + ": unknown key " + key);
+            continue;
+        }
+
+        auto& v = d.variants.back();
+        if (key == "l0") v.l0 = value;
+        else if (key == "l1") v.l1 = value;
+        else if (key == "mid") v.mid = value;
+        else if (key == "mid_branching") v.mid_branching = std::stoull(value);
+        else if (key == "merged") v.merged = std::stoull(value);
+        else if (key == "branching") v.branching = std::stoull(value);
+        else if (key == "size") v.size = std::stoull(value);
+        else if (key == "l0_parameters") {
+            std::stringstream ss(value);
+            std::string p;
+            while (ss >> p)
+                v.l0_parameters.push_back(p);
+        }
+        else throw std::runtime_error(filename + ": unknown key " + key);
+    }
+    return d;
+}
+
+/**
+ * A two- or three-level RMI whose models are chosen at runtime. It owns the parameters read from the files of a
+ * description. The lookups run on the TwoLevelRMI of the chosen models, passed by @ref visit: the type of the models
+ * is dispatched once per index, and not at each query.
+ */
+class RuntimeRMI {
+public:
+    enum class Root { linear, cubic, radix, radix_table };
+    enum class Leaf { linear, cubic, compact12, compact8 };
+
+private:
+    Description desc;
+    Root root;
+    Leaf leaf;
+    std::vector<double> fparams;    ///< The parameters of the linear and cubic roots.
+    std::vector<uint64_t> iparams;  ///< The parameters of the radix and radix_table roots.
+    bool layered = false;           ///< Whether there is a middle layer.
+    mem::vector<char> l1_parameters;            ///< The leaves of a model built in memory.
+    mem::vector<uint32_t> l0_table;
+    mem::vector<char> mid_parameters;
+    mem::vector<uint32_t> leaf_map;
+    std::shared_ptr<const char> l1_file;        ///< The leaves loaded from a parameter file, shared by the copies.
+    std::shared_ptr<const uint32_t> l0_file;
+    std::shared_ptr<const char> mid_file;
+    std::shared_ptr<const uint32_t> map_file;
+    mem::vector<LeafBounds> l1_bounds;  ///< Empty, or the asymmetric bounds of each leaf.
+
+    template<typename T>
+    static std::shared_ptr<const T> load(const std::filesystem::path& path, size_t count) {
+        auto p = static_cast<const T*>(mem::load_file(path.string(), count * sizeof(T)));
+        if (p == nullptr)
+            throw std::runtime_error("unable to read " + std::to_string(count * sizeof(T)) + " bytes from " + path.string());
+        return std::shared_ptr<const T>(p, [](const T* p) { mem::deallocate(const_cast<T*>(p)); });
+    }
+
+    const char* leaves() const { return l1_file ? l1_file.get() : l1_parameters.data(); }
+
+    const uint32_t* table() const { return l0_file ? l0_file.get() : l0_table.data(); }
+
+    const char* inner() const { return mid_file ? mid_file.get() : mid_parameters.data(); }
+
+    const uint32_t* map() const { return map_file ? map_file.get() : leaf_map.data(); }
+
+    /// The number of outputs of the root model: the models of the middle layer, or the leaves.
+    size_t root_branching() const { return layered ? desc.mid_branching : desc.branching; }
+
+    template<typename L, typename R, typename F>
+    decltype(auto) visit_leaves(const R& r, F&& f) const {
+        auto bounds = l1_bounds.empty() ? nullptr : l1_bounds.data();
+        if constexpr (!L::relative) {
+            if (desc.merged)
+                return f(TwoLevelRMI<MappedRoot<R>, L>({r, map(), desc.branching}, leaves(), desc.size, bounds));
+        }
+        return f(TwoLevelRMI<R, L>(r, leaves(), desc.size, bounds));
+    }
+
+    template<typename L, typename R, typename F>
+    decltype(auto) visit_levels(const R& r, F&& f) const {
+        if (layered)
+            return visit_leaves<L>(LayeredRoot<R, LinearInner>{r, inner(), desc.mid_branching, double(desc.branching)}, f);
+        return visit_leaves<L>(r, f);
+    }
+
+    template<typename L, typename F>
+    decltype(auto) visit_root(F&& f) const {
+        switch (root) {
+            case Root::linear:
+                return visit_levels<L>(LinearRoot{fparams[0], fparams[1], double(root_branching())}, f);
+            case Root::cubic:
+                return visit_levels<L>(CubicRoot{fparams[0], fparams[1], fparams[2], fparams[3]}, f);
+            case Root::radix:
+                return visit_levels<L>(RadixRoot{iparams[0], iparams[1]}, f);
+            default:
+                return visit_levels<L>(RadixTableRoot{table(), iparams[0], iparams[1]}, f);
+        }
+    }
+
+    /// Reads the models and the root parameters from the description.
+    void parse_description() {
+        auto params = desc.l0_parameters.size();
+        if (desc.l0 == "linear" && params == 2) root = Root::linear;
+        else if (desc.l0 == "cubic" && params == 4) root = Root::cubic;
+        else if (desc.l0 == "radix" && params == 2) root = Root::radix;
+        else if (desc.l0 == "radix_table" && params == 2) root = Root::radix_table;
+        else throw std::runtime_error(desc.name + ": invalid l0 model " + desc.l0 + " with " + std::to_string(params) + " parameters");
+
+        if (desc.l1 == "linear") leaf = Leaf::linear;
+        else if (desc.l1 == "cubic") leaf = Leaf::cubic;
+        else if (desc.l1 == "compact12") leaf = Leaf::compact12;
+        else if (desc.l1 == "compact8") leaf = Leaf::compact8;
+        else throw std::runtime_error(desc.name + ": invalid l1 model " + desc.l1);
+
+        if (desc.mid == "linear") layered = true;
+        else if (!desc.mid.empty()) throw std::runtime_error(desc.name + ": invalid mid model " + desc.mid);
+
+        if (desc.branching == 0 || desc.size == 0 || (layered && desc.mid_branching == 0))
+            throw std::runtime_error(desc.name + ": branching and size must be > 0");
+        if (desc.merged > desc.branching || (desc.merged && (leaf == Leaf::compact12 || leaf == Leaf::compact8)))
+            throw std::runtime_error(desc.name + ": merged leaves must be at most branching, and linear or cubic");
+
+        for (auto& p : desc.l0_parameters) {
+            if (root == Root::linear || root == Root::cubic)
+                fparams.push_back(std::stod(p));
+            else
+                iparams.push_back(std::stoull(p));
+        }
+    }
+
+    size_t table_size() const { return size_t(1) << (64 - iparams[0] - iparams[1]); }
+
+public:
+    /**
+     * Loads the parameters of a variant from the directory @p dir, according to the load mode of mem::policy().
+     * Throws std::runtime_error if the description is invalid or a parameter file cannot be read.
+     */
+    RuntimeRMI(const Description& description, const std::string& dir) : desc(description) {
+        parse_description();
+        auto path = std::filesystem::path(dir);
+        if (root == Root::radix_table)
+            l0_file = load<uint32_t>(path / (desc.name + "_L0_PARAMETERS"), table_size());
+        if (layered)
+            mid_file = load<char>(path / (desc.name + "_LM_PARAMETERS"), desc.mid_branching * LinearInner::bytes);
+        if (desc.merged)
+            map_file = load<uint32_t>(path / (desc.name + "_MAP_PARAMETERS"), desc.branching);
+        l1_file = load<char>(path / (desc.name + "_L1_PARAMETERS"), leaf_count() * leaf_bytes());
+    }
+
+    /**
+     * Takes the parameters of a variant built in memory (see rmi_builder.h). Throws std::runtime_error if the
+     * description is invalid or does not match the size of the parameters.
+     */
+    RuntimeRMI(const Description& description, mem::vector<char>&& l1, mem::vector<uint32_t>&& table = {},
+               mem::vector<char>&& mid = {}, mem::vector<uint32_t>&& map = {})
+        : desc(description), l1_parameters(std::move(l1)), l0_table(std::move(table)), mid_parameters(std::move(mid)),
+          leaf_map(std::move(map)) {
+        parse_description();
+        if (l1_parameters.size() != leaf_count() * leaf_bytes() || (root == Root::radix_table && l0_table.size() != table_size())
+            || mid_parameters.size() != (layered ? desc.mid_branching * LinearInner::bytes : 0)
+            || leaf_map.size() != (desc.merged ? desc.branching : 0))
+            throw std::runtime_error(desc.name + ": the parameters do not match the description");
+    }
+
+    const Description& description() const { return desc; }
+
+    /**
+     * Returns a copy of this variant with other leaves, of the model @p l1 (see rmi::compact). If @p map is not empty,
+     * the leaves replace runs of the current ones, and map has the new leaf of each output of the root (see
+     * rmi::merge_leaves). The other parameters are shared or copied. Throws std::runtime_error if the model is invalid
+     * or does not match the size of the leaves.
+     */
+    RuntimeRMI with_leaves(const std::string& l1, mem::vector<char>&& leaves, mem::vector<uint32_t>&& map = {}) const {
+        auto r = *this;
+        r.desc.l1 = l1;
+        r.fparams.clear();
+        r.iparams.clear();
+        r.parse_description();
+        if (!map.empty()) {
+            if (map.size() != desc.branching || r.leaf == Leaf::compact12 || r.leaf == Leaf::compact8)
+                throw std::runtime_error(desc.name + ": merged leaves need one index per leaf, and linear or cubic leaves");
+            r.desc.merged = leaves.size() / r.leaf_bytes();
+            r.leaf_map = std::move(map);
+            r.map_file.reset();
+        }
+        if (leaves.size() != r.leaf_count() * r.leaf_bytes())
+            throw std::runtime_error(desc.name + ": the parameters do not match the description");
+        r.l1_parameters = std::move(leaves);
+        r.l1_file.reset();
+        r.l1_bounds.clear();
+        return r;
+    }
+
+    /**
+     * Sets the asymmetric bounds of the leaves (see rmi::fit_bounds), used by the lookup_range of the models instead of
+     * the errors of the leaves. Throws std::runtime_error if there is not one per leaf.
+     */
+    void set_bounds(mem::vector<LeafBounds>&& bounds) {
+        if (bounds.size() != leaf_count())
+            throw std::runtime_error(desc.name + ": expected " + std::to_string(leaf_count()) + " leaf bounds");
+        l1_bounds = std::move(bounds);
+    }
+
+    bool has_bounds() const { return !l1_bounds.empty(); }
+
+    /// The number of leaves: the branching factor, or the number of leaves after merging.
+    size_t leaf_count() const { return desc.merged ? desc.merged : desc.branching; }
+
+    size_t leaf_bytes() const {
+        switch (leaf) {
+            case Leaf::linear: return LinearLeaf::bytes;
+            case Leaf::cubic: return CubicLeaf::bytes;
+            case Leaf::compact12: return CompactLeaf12::bytes;
+            default: return CompactLeaf8::bytes;
+        }
+    }
+
+    /**
+     * Returns the size of the parameters in bytes, as the RMI_SIZE of the generated code, plus that of the middle layer,
+     * of the table of merged leaves and of the bounds.
+     */
+    size_t size_in_bytes() const {
+        auto root_bytes = root == Root::radix_table ? table_size() * sizeof(uint32_t) : desc.l0_parameters.size() * 8;
+        auto mid_bytes = layered ? desc.mid_branching * LinearInner::bytes : 0;
+        auto map_bytes = desc.merged ? desc.branching * sizeof(uint32_t) : 0;
+        return root_bytes + mid_bytes + map_bytes + leaf_count() * leaf_bytes() + l1_bounds.size() * sizeof(LeafBounds);
+    }
+
+    /**
+     * Calls @p f with the TwoLevelRMI (or ThreeLevelRMI) of the models of this variant, and returns its result. It
+     * refers to the parameters of this object, so it must not outlive it.
+     */
+    template<typename F>
+    decltype(auto) visit(F&& f) const {
+        switch (leaf) {
+            case Leaf::linear: return visit_root<LinearLeaf>(f);
+            case Leaf::cubic: return visit_root<CubicLeaf>(f);
+            case Leaf::compact12: return visit_root<CompactLeaf12>(f);
+            default: return visit_root<CompactLeaf8>(f);
+        }
+    }
+};
+
+}
+
+#endif /* rmi_runtime_h */
@@ -10,9 +10,36 @@
 
 //#define IS_PREFETCH
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 namespace search {
+/**
+ * Prefetches the cache lines spanned by [start, end). Long ranges are trimmed to the max_lines lines around their
+ * middle, which is where both a binary search and an error-bounded prediction start.
+ */
+template<size_t max_lines = 8, typename T>
+inline void prefetch_range(const T* start, const T* end) {
+    constexpr size_t line = 64;
+    auto b = reinterpret_cast<uintptr_t>(start) & ~(line - 1);
+    auto e = reinterpret_cast<uintptr_t>(end);
+    if (e - b > max_lines * line) {
+        b = (b + (e - b) / 2 - max_lines * line / 2) & ~(line - 1);
+        e = b + max_lines * line;
+    }
+    for (; b < e; b += line)
+        __builtin_prefetch(reinterpret_cast<const void*>(b));
+}
+
 template<typename RandomIt, typename K>
 inline RandomIt lower_bound_linear(RandomIt start, RandomIt end, const K& key) {
     auto it = start;
@@ -56,8 +83,8 @@ inline RandomIt lower_bound_interpolation(RandomIt start, RandomIt end, const K&
             break;
             
         auto lo_key = *lo, hi_key = *hi;
-        auto est_pos_rel = (double)(key - lo_key)/(float)(hi_key - lo_key);
-        auto offset = (size_t)(est_pos_rel * n);
+        auto est_pos_rel = (double)(key - lo_key)/(double)(hi_key - lo_key);
+        auto offset = std::min((size_t)(est_pos_rel * n), (size_t)n);
         auto mid = lo + offset;
         
         if (mid == lo)
@@ -81,6 +108,123 @@ inline RandomIt lower_bound_interpolation(RandomIt start, RandomIt end, const K&
 }
 
 
+/**
+ * Returns the number of keys in p[0, n) that are smaller than key (or smaller than or equal to key,
+ * if or_equal is set). The comparisons are done 8 keys per instruction with AVX-512 and 4 with AVX2,
+ * and the count is obtained with a popcount of the comparison masks, so there is no data-dependent branch.
+ *
+ * With stride = 2, p points to n records of 16 bytes each starting with a uint64_t key (e.g., the
+ * packed segments of a PGM-index): the records are loaded as they are and only the key lanes are
+ * compared, so that no gather is needed.
+ */
+template<bool or_equal = false, size_t stride = 1>
+inline size_t count_less_simd(const uint64_t* p, size_t n, uint64_t key) {
+    static_assert(stride == 1 || stride == 2, "Records must be of 8 or 16 bytes");
+    const size_t words = n * stride;
+    size_t i = 0, cnt = 0;
+#if defined(__AVX512F__)
+    constexpr int cmp = or_equal ? _MM_CMPINT_LE : _MM_CMPINT_LT;
+    constexpr __mmask8 lanes = stride == 1 ? 0xFF : 0x55;
+    const __m512i k = _mm512_set1_epi64(key);
+    for (; i + 16 <= words; i += 16) {
+        auto m0 = _mm512_mask_cmp_epu64_mask(lanes, _mm512_loadu_si512(p + i), k, cmp);
+        auto m1 = _mm512_mask_cmp_epu64_mask(lanes, _mm512_loadu_si512(p + i + 8), k, cmp);
+        cnt += __builtin_popcount(m0) + __builtin_popcount(m1);
+    }
+    for (; i < words; i += 8) {
+        __mmask8 tail = words - i >= 8 ? 0xFF : (1u << (words - i)) - 1;
+        auto m = _mm512_mask_cmp_epu64_mask(tail & lanes, _mm512_maskz_loadu_epi64(tail, p + i), k, cmp);
+        cnt += __builtin_popcount(m);
+    }
+#elif defined(__AVX2__)
+    // AVX2 only compares signed integers: flip the sign bits to compare unsigned ones
+    constexpr int lanes = stride == 1 ? 0xF : 0x5;
+    const __m256i sign = _mm256_set1_epi64x(0x8000000000000000ull);
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+    auto count = [&](const uint64_t* q) {
+        auto v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) q), sign);
+        if constexpr (or_equal) // v <= k iff not v > k
+            return __builtin_popcount(~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k))) & lanes);
+        else
+            return __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))) & lanes);
+    };
+    for (; i + 8 <= words; i += 8)
+        cnt += count(p + i) + count(p + i + 4);
+    for (; i < words; i += stride)
+        cnt += or_equal ? p[i] <= key : p[i] < key;
+#else
+    for (; i < words; i += stride)
+        cnt += or_equal ? p[i] <= key : p[i] < key;
+#endif
+    return cnt;
+}
+
+/**
+ * Returns the offset of the lower bound (or of the upper bound, if upper is set) of key in the n
+ * records at p. Branchless binary steps narrow the range down to scan_size records, which are then
+ * counted by @ref count_less_simd.
+ */
+template<bool upper, size_t scan_size, size_t stride = 1>
+inline size_t bound_simd(const uint64_t* p, size_t n, uint64_t key) {
+    size_t base = 0;
+    
+    while (n > scan_size) {
+        auto half = n / 2;
+        auto k = p[(base + half - 1) * stride];
+        base = (upper ? k <= key : k < key) ? base + half : base; // w.r.t. cmov instruction
+        n -= half;
+    }
+    
+    return base + count_less_simd<upper, stride>(p + base * stride, n, key);
+}
+
+template<bool upper, size_t scan_size, typename RandomIt, typename K>
+inline RandomIt bound_simd(RandomIt start, RandomIt end, const K& key) {
+    if constexpr (std::is_same_v<typename std::iterator_traits<RandomIt>::value_type, uint64_t>) {
+        return start + bound_simd<upper, scan_size>(&*start, std::distance(start, end), key);
+    } else if constexpr (upper) {
+        return std::upper_bound(start, end, key);
+    } else {
+        return std::lower_bound(start, end, key);
+    }
+}
+
+/**
+ * Lower bound by a SIMD scan of the whole range. Meant for the short windows returned by an
+ * error-bounded index, where scanning every key is cheaper than the mispredictions of a binary search.
+ */
+template<typename RandomIt, typename K>
+inline RandomIt lower_bound_simd(RandomIt start, RandomIt end, const K& key) {
+    return bound_simd<false, std::numeric_limits<size_t>::max()>(start, end, key);
+}
+
+/**
+ * Lower bound by branchless binary steps until at most scan_size keys are left, followed by a SIMD scan.
+ */
+template<size_t scan_size = 32, typename RandomIt, typename K>
+inline RandomIt lower_bound_simd_hybrid(RandomIt start, RandomIt end, const K& key) {
+    return bound_simd<false, scan_size>(start, end, key);
+}
+
+/**
+ * Lower bound on a range of at most max_size keys, where max_size is known at compile time (e.g.,
+ * 2 * Epsilon + 2 for a PGM-index): short ranges are scanned entirely, longer ones first take
+ * branchless binary steps down to scan_size keys.
+ */
+template<size_t max_size, size_t scan_size = 32, typename RandomIt, typename K>
+inline RandomIt lower_bound_simd_bounded(RandomIt start, RandomIt end, const K& key) {
+    return bound_simd<false, (max_size <= 2 * scan_size ? max_size : scan_size)>(start, end, key);
+}
+
+/**
+ * Upper bound counterpart of @ref lower_bound_simd_bounded.
+ */
+template<size_t max_size, size_t scan_size = 32, typename RandomIt, typename K>
+inline RandomIt upper_bound_simd_bounded(RandomIt start, RandomIt end, const K& key) {
+    return bound_simd<true, (max_size <= 2 * scan_size ? max_size : scan_size)>(start, end, key);
+}
+
+
 template<typename RandomIt, typename K>
 inline RandomIt upper_bound_branchless(RandomIt start, RandomIt end, const K& key) {
     auto base = start;
@@ -94,6 +238,129 @@ inline RandomIt upper_bound_branchless(RandomIt start, RandomIt end, const K& ke
 
     return base;
 }
+
+/**
+ * Lower bound by interpolation search that only reads [start, end), for the windows returned by an index, which may end
+ * anywhere in the data. The probe is interpolated in double and clamped to the window, and after max_steps probes, or
+ * once the window is below search_bound keys, the rest is left to a binary search.
+ */
+template<typename RandomIt, typename K, size_t search_bound = 64, size_t max_steps = 8>
+inline RandomIt lower_bound_interpolation_window(RandomIt start, RandomIt end, const K& key) {
+    // The result is in [lo, hi]: the keys before lo are below key, the keys from hi on are not
+    auto lo = start, hi = end;
+    for (size_t step = 0; step < max_steps && hi - lo >= ptrdiff_t(search_bound); ++step) {
+        auto lo_key = *lo, hi_key = *(hi - 1);
+        if (key <= lo_key)
+            return lo;
+        if (key > hi_key)
+            return hi;
+        auto n = size_t(hi - lo - 1);
+        auto offset = size_t((double)(key - lo_key) / (double)(hi_key - lo_key) * (double)n);
+        auto mid = lo + std::min(offset, n);
+        if (*mid < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return std::lower_bound(lo, hi, key);
+}
+
+/**
+ * Lower bound by exponential (galloping) search outward from pos, the position predicted by an index, followed by a
+ * binary search between the last two probes. It takes O(log d) steps, where d is the distance of the result from pos,
+ * so it beats a binary search of the whole range when the actual error is much smaller than the bound of the index.
+ */
+template<typename RandomIt, typename K>
+inline RandomIt lower_bound_exponential(RandomIt start, RandomIt end, RandomIt pos, const K& key) {
+    if (start == end)
+        return end;
+    pos = std::clamp(pos, start, std::prev(end));
+    size_t step = 1;
+    if (*pos < key) {
+        auto lo = std::next(pos);
+        auto max_step = size_t(std::distance(pos, end));
+        while (step < max_step && pos[step] < key) {
+            lo = pos + step + 1;
+            step *= 2;
+        }
+        return std::lower_bound(lo, step < max_step ? pos + step : end, key);
+    } else {
+        auto hi = pos;
+        auto max_step = size_t(std::distance(start, pos));
+        while (step <= max_step && *(pos - step) >= key) {
+            hi = pos - step;
+            step *= 2;
+        }
+        return std::lower_bound(step <= max_step ? pos - step + 1 : start, hi, key);
+    }
+}
+
+/// The last-mile strategies: the searches of a key in the range [lo, hi) given by an index (see @ref last_mile).
+enum class LastMile { binary, branchless, linear, simd, exponential, interpolation };
+
+/// All the strategies, in the order of the benchmark results.
+constexpr LastMile last_miles[] = {LastMile::binary, LastMile::branchless, LastMile::linear, LastMile::simd,
+                                   LastMile::exponential, LastMile::interpolation};
+
+inline const char* to_string(LastMile s) {
+    switch (s) {
+        case LastMile::binary: return "binary";
+        case LastMile::branchless: return "branchless";
+        case LastMile::linear: return "linear";
+        case LastMile::simd: return "simd";
+        case LastMile::exponential: return "exponential";
+        default: return "interpolation";
+    }
+}
+
+/**
+ * Returns the lower bound of key in [lo, hi) with the strategy S. pos is the position predicted by the index, where
+ * the exponential search starts; the other strategies ignore it.
+ */
+template<LastMile S, typename RandomIt, typename K>
+inline RandomIt last_mile(RandomIt lo, RandomIt hi, RandomIt pos, const K& key) {
+    if constexpr (S == LastMile::binary)
+        return std::lower_bound(lo, hi, key);
+    else if constexpr (S == LastMile::branchless)
+        return lower_bound_branchless(lo, hi, key);
+    else if constexpr (S == LastMile::linear)
+        return lower_bound_linear(lo, hi, key);
+    else if constexpr (S == LastMile::simd)
+        return lower_bound_simd(lo, hi, key);
+    else if constexpr (S == LastMile::exponential)
+        return lower_bound_exponential(lo, hi, pos, key);
+    else
+        return lower_bound_interpolation_window(lo, hi, key);
+}
+
+/**
+ * Calls f with std::integral_constant<LastMile, s>, to run the code compiled for a strategy chosen at runtime.
+ */
+template<typename F>
+inline decltype(auto) with_last_mile(LastMile s, F&& f) {
+    switch (s) {
+        case LastMile::binary: return f(std::integral_constant<LastMile, LastMile::binary>());
+        case LastMile::branchless: return f(std::integral_constant<LastMile, LastMile::branchless>());
+        case LastMile::linear: return f(std::integral_constant<LastMile, LastMile::linear>());
+        case LastMile::simd: return f(std::integral_constant<LastMile, LastMile::simd>());
+        case LastMile::exponential: return f(std::integral_constant<LastMile, LastMile::exponential>());
+        default: return f(std::integral_constant<LastMile, LastMile::interpolation>());
+    }
+}
+
+/**
+ * Returns the first and the last count keys of [start, end). Their last-mile windows touch the ends of the array, so
+ * a strategy checked on them in a build with -fsanitize=address cannot read outside of its window unnoticed.
+ */
+template<typename RandomIt>
+inline std::vector<typename std::iterator_traits<RandomIt>::value_type> edge_keys(RandomIt start, RandomIt end, size_t count = 64) {
+    auto n = size_t(end - start);
+    if (n <= 2 * count)
+        return {start, end};
+    std::vector<typename std::iterator_traits<RandomIt>::value_type> keys(start, start + count);
+    keys.insert(keys.end(), end - count, end);
+    return keys;
+}
 }
 
 template<typename K>